@@ -1,3 +1,4 @@
 #define MAX_WRITE_SIZE 256
 #define MAX_STRING_SIZE 40
 #define MAX_JOB_FILE_NAME_SIZE 256
+#define PARSER_BUFFER_SIZE 65536
@@ -3,9 +3,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <ctype.h>
 #include "constants.h"
 
+_Static_assert(TABLE_SIZE <= 32, "bucket sets are 32-bit masks");
+
 // Hash function based on key initial.
 // @param key Lowercase alphabetical string.
 // @return hash.
@@ -31,6 +34,7 @@ struct HashTable* create_hash_table() {
   if (!ht) return NULL;
   for (int i = 0; i < TABLE_SIZE; i++) {
       ht->table[i] = NULL;
+      pthread_rwlock_init(&ht->bucket_locks[i], NULL);
   }
   pthread_mutex_init(&ht->global_lock, NULL);
   return ht;
@@ -55,69 +59,59 @@ int write_pair(HashTable *ht, const char *key, const char *value) {
     keyNode->key = strdup(key); // Allocate memory for the key
     keyNode->value = strdup(value); // Allocate memory for the value
     keyNode->next = ht->table[index]; // Link to existing nodes
-    pthread_rwlock_init(&keyNode->lock, NULL);
-    pthread_rwlock_wrlock(&keyNode->lock);
-    
     ht->table[index] = keyNode; // Place new key node at the start of the list
     return 0;
 }
 
-void keys_wrlock(HashTable *ht, size_t num_pairs, char keys[][MAX_STRING_SIZE]) {
-    int exists[TABLE_SIZE];
-
-    char sorted_keys[MAX_WRITE_SIZE][MAX_STRING_SIZE];
-
-    memcpy(sorted_keys, keys, sizeof(char) * MAX_STRING_SIZE * MAX_WRITE_SIZE);
+// Computes the set of buckets holding a list of keys.
+// @return Bit i is set if some key hashes to bucket i.
+static uint32_t key_buckets(size_t num_pairs, char keys[][MAX_STRING_SIZE]) {
+  uint32_t buckets = 0;
 
-    qsort(sorted_keys, num_pairs, MAX_STRING_SIZE, compare_strings);
+  for (size_t i = 0; i < num_pairs; i++) {
+    int key_hash = hash(keys[i]);
+    if (key_hash >= 0) buckets |= 1u << key_hash;
+  }
+  return buckets;
+}
 
-    for (size_t i = 0; i < num_pairs; i++) {
-        int key_hash = hash(sorted_keys[i]);
-        if (exists[key_hash]) continue;
+void keys_wrlock(HashTable *ht, size_t num_pairs, char keys[][MAX_STRING_SIZE]) {
+  uint32_t buckets = key_buckets(num_pairs, keys);
 
-        KeyNode *key_node = ht->table[key_hash];
-        if (key_node) pthread_rwlock_wrlock(&key_node->lock);
-        exists[key_hash] = 1;
-    }
+  // lowest bucket first, so every thread locks in the same order
+  while (buckets != 0) {
+    pthread_rwlock_wrlock(&ht->bucket_locks[__builtin_ctz(buckets)]);
+    buckets &= buckets - 1;
+  }
 }
 
 void keys_rdlock(HashTable *ht, size_t num_pairs, char keys[][MAX_STRING_SIZE]) {
-  int exists[TABLE_SIZE];
-
-  for (size_t i = 0; i < num_pairs; i++) {
-    int key_hash = hash(keys[i]);
-    if (exists[key_hash]) continue;
+  uint32_t buckets = key_buckets(num_pairs, keys);
 
-    KeyNode *key_node = ht->table[key_hash];
-    if (key_node) pthread_rwlock_rdlock(&key_node->lock);
-    exists[key_hash] = 1;
+  while (buckets != 0) {
+    pthread_rwlock_rdlock(&ht->bucket_locks[__builtin_ctz(buckets)]);
+    buckets &= buckets - 1;
   }
 }
 
 void keys_rdlock_global(HashTable *ht) {
   for (size_t i = 0; i < TABLE_SIZE; i++) {
-    KeyNode *key_node = ht->table[i];
-    if (key_node) pthread_rwlock_rdlock(&key_node->lock);
+    pthread_rwlock_rdlock(&ht->bucket_locks[i]);
   }
 }
 
 void keys_unlock_global(HashTable *ht) {
   for (size_t i = 0; i < TABLE_SIZE; i++) {
-    KeyNode *key_node = ht->table[i];
-    if (key_node) pthread_rwlock_unlock(&key_node->lock);
+    pthread_rwlock_unlock(&ht->bucket_locks[i]);
   }
 }
 
 void keys_unlock(HashTable *ht, size_t num_pairs, char keys[][MAX_STRING_SIZE]) {
-  int exists[TABLE_SIZE];
+  uint32_t buckets = key_buckets(num_pairs, keys);
 
-  for (size_t i = 0; i < num_pairs; i++) {
-    int key_hash = hash(keys[i]);
-    if (exists[key_hash]) continue;
-
-    KeyNode *key_node = ht->table[key_hash];
-    if (key_node) pthread_rwlock_unlock(&key_node->lock);
-    exists[key_hash] = 1;
+  while (buckets != 0) {
+    pthread_rwlock_unlock(&ht->bucket_locks[__builtin_ctz(buckets)]);
+    buckets &= buckets - 1;
   }
 }
 
@@ -176,6 +170,9 @@ void free_table(HashTable *ht) {
             free(temp);
         }
     }
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        pthread_rwlock_destroy(&ht->bucket_locks[i]);
+    }
     pthread_mutex_destroy(&ht->global_lock);
     free(ht);
 }
@@ -12,11 +12,11 @@ typedef struct KeyNode {
     char *key;
     char *value;
     struct KeyNode *next;
-    pthread_rwlock_t lock;
 } KeyNode;
 
 typedef struct HashTable {
     KeyNode *table[TABLE_SIZE];
+    pthread_rwlock_t bucket_locks[TABLE_SIZE]; // one per list of the table
     pthread_mutex_t global_lock;
 } HashTable;
 
@@ -47,7 +47,7 @@ int delete_pair(HashTable *ht, const char *key);
 /// @param ht Hash table to be deleted.
 void free_table(HashTable *ht);
 
-/// Locks the list of keys for writing
+/// Locks the buckets of the list of keys for writing, in bucket order
 void keys_wrlock(HashTable *ht, size_t num_pairs, char keys[][MAX_STRING_SIZE]);
 /// Locks the list of keys for reading
 void keys_rdlock(HashTable *ht, size_t num_pairs, char keys[][MAX_STRING_SIZE]);
@@ -15,18 +15,23 @@
 #include "operations.h"
 
 #include <pthread.h>
-#include <semaphore.h>
+#include <stdatomic.h>
 
 pthread_rwlock_t rwlock;
 
-// static unsigned int concurrent_threads = 0;
-static sem_t threads_mutex;
-
 typedef struct {
     char file_path_base[PATH_MAX];
     int result;  
 } job_thread_args_t;
 
+// Jobs shared by the worker threads. Each worker takes the next job by
+// bumping next_job, so running a job costs no lock and no thread creation.
+typedef struct {
+    job_thread_args_t *jobs;
+    unsigned int job_count;
+    atomic_uint next_job;
+} job_pool_t;
+
 int has_job_extension(const char *filename) {
     const char *dot = strrchr(filename, '.');
     return (dot && strcmp(dot, ".job") == 0);
@@ -50,6 +55,7 @@ int process_job(const char *base_file_path) {
     int fd_output = open(output_file_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
     if (fd_output == -1) {
         fprintf(stderr, "Error opening/creating output file '%s': %s\n", output_file_path, strerror(errno));
+        parser_reset(fd_input);
         close(fd_input);
         return EXIT_FAILURE;
     }
@@ -62,19 +68,10 @@ int process_job(const char *base_file_path) {
         char values[MAX_WRITE_SIZE][MAX_STRING_SIZE] = {0};
         unsigned int delay;
         size_t num_pairs;
-        off_t last_position = lseek(fd_input, 0, SEEK_CUR);
-        if (last_position == (off_t)-1) {
-            perror("lseek failed");
-            break;
-        }
 
         switch (get_next(fd_input)) { 
 
             case CMD_WRITE:
-                if (lseek(fd_input, last_position + 6, SEEK_SET) == (off_t)-1) { 
-                    perror("lseek failed");
-                    break;
-                }
                 num_pairs = parse_write(fd_input, keys, values, MAX_WRITE_SIZE, MAX_STRING_SIZE);
                 if (num_pairs == 0) {
                     fprintf(stderr, "Invalid WRITE command. See HELP for usage\n");
@@ -83,6 +80,7 @@ int process_job(const char *base_file_path) {
 
                 if (pthread_rwlock_wrlock(&rwlock) != 0) {
                     perror("Failed to acquire write lock");
+                    parser_reset(fd_input);
                     close(fd_input);
                     close(fd_output);
                     return EXIT_FAILURE;
@@ -97,10 +95,6 @@ int process_job(const char *base_file_path) {
                 break;
 
             case CMD_READ:
-                if (lseek(fd_input, last_position + 5, SEEK_SET) == (off_t)-1) { 
-                    perror("lseek failed");
-                    break;
-                }
                 num_pairs = parse_read_delete(fd_input, keys, MAX_WRITE_SIZE, MAX_STRING_SIZE);
                 if (num_pairs == 0) {
                     fprintf(stderr, "Invalid READ command. See HELP for usage\n");
@@ -109,6 +103,7 @@ int process_job(const char *base_file_path) {
 
                 if (pthread_rwlock_rdlock(&rwlock) != 0) {
                     perror("Failed to acquire read lock");
+                    parser_reset(fd_input);
                     close(fd_input);
                     close(fd_output);
                     return EXIT_FAILURE;
@@ -123,10 +118,6 @@ int process_job(const char *base_file_path) {
                 break;
 
             case CMD_DELETE:
-                if (lseek(fd_input, last_position + 7, SEEK_SET) == (off_t)-1) { 
-                    perror("lseek failed");
-                    break;
-                }
                 num_pairs = parse_read_delete(fd_input, keys, MAX_WRITE_SIZE, MAX_STRING_SIZE);
 
                 if (num_pairs == 0) {
@@ -136,6 +127,7 @@ int process_job(const char *base_file_path) {
 
                 if (pthread_rwlock_wrlock(&rwlock) != 0) {
                     perror("Failed to acquire write lock");
+                    parser_reset(fd_input);
                     close(fd_input);
                     close(fd_output);
                     return EXIT_FAILURE;
@@ -152,6 +144,7 @@ int process_job(const char *base_file_path) {
             case CMD_SHOW:
                 if (pthread_rwlock_rdlock(&rwlock) != 0) {
                     perror("Failed to acquire read lock");
+                    parser_reset(fd_input);
                     close(fd_input);
                     close(fd_output);
                     return EXIT_FAILURE;
@@ -164,10 +157,6 @@ int process_job(const char *base_file_path) {
                 break;
 
             case CMD_WAIT:
-                if (lseek(fd_input, last_position + 5, SEEK_SET) == (off_t)-1) { 
-                    perror("lseek failed");
-                    break;
-                }
                 if (parse_wait(fd_input, &delay, NULL) == -1) {
                     fprintf(stderr, "Invalid WAIT command. See HELP for usage\n");
                     continue;
@@ -182,6 +171,7 @@ int process_job(const char *base_file_path) {
             case CMD_BACKUP:
                 if (pthread_rwlock_wrlock(&rwlock) != 0) {
                     perror("Failed to acquire write lock");
+                    parser_reset(fd_input);
                     close(fd_input);
                     close(fd_output);
                     return EXIT_FAILURE;
@@ -217,6 +207,7 @@ int process_job(const char *base_file_path) {
 
             case EOC:
                 printf("Done!\n\n");
+                parser_reset(fd_input);
                 close(fd_input);
                 close(fd_output);
                 return EXIT_SUCCESS;
@@ -225,17 +216,21 @@ int process_job(const char *base_file_path) {
                 break;
         }
     }
+    parser_reset(fd_input);
     close(fd_input);
     close(fd_output);
     return EXIT_FAILURE;
 }
 
 void *process_job_thread(void *arg) {
-    job_thread_args_t *targ = (job_thread_args_t *) arg;
-    
-    targ->result = process_job(targ->file_path_base);
-    em_post(&threads_mutex);
-    resturn &targ->result;
+    job_pool_t *pool = (job_pool_t *) arg;
+    unsigned int i;
+
+    while ((i = atomic_fetch_add(&pool->next_job, 1)) < pool->job_count) {
+        job_thread_args_t *targ = &pool->jobs[i];
+        targ->result = process_job(targ->file_path_base);
+    }
+    return NULL;
 }
 
 int main(int argc, char *argv[]) {
@@ -277,6 +272,11 @@ int main(int argc, char *argv[]) {
 
     max_threads = (unsigned int) max_threads_l;
 
+    if (max_threads == 0) {
+        fprintf(stderr, "Error: Invalid number of threads\n");
+        return EXIT_FAILURE;
+    }
+
     printf("Number of backups: %d\n", backups_number);
     fflush(stdout);
 
@@ -309,7 +309,12 @@ int main(int argc, char *argv[]) {
         goto cleanup;
     }
 
-    thread_ids = malloc(sizeof(pthread_t) * job_count);
+    // no more workers than jobs
+    if (max_threads > job_count) {
+        max_threads = job_count;
+    }
+
+    thread_ids = malloc(sizeof(pthread_t) * max_threads);
     if (thread_ids == NULL) {
         fprintf(stderr, "Failed to allocate memory for thread IDs.\n");
         goto cleanup;
@@ -364,24 +369,34 @@ int main(int argc, char *argv[]) {
         job_id++;
     }
 
-    if (sem_init(&threads_mutex, 0, max_threads) != 0) {
-        goto cleanup;
-    }
-
-    for (size_t i = 0; i < job_count; i++) {
-        job_thread_args_t *arg = &args[i];
-        
-        sem_wait(&threads_mutex);
+    job_pool_t pool;
+    pool.jobs = args;
+    pool.job_count = (unsigned int) job_id;
+    atomic_init(&pool.next_job, 0);
 
-        if (pthread_create(&thread_ids[i], NULL, process_job_thread, arg) != 0) {
-            fprintf(stderr, "Failed to create thread for job %s\n", arg->file_path_base);
+    unsigned int num_threads = 0;
+    for (; num_threads < max_threads; num_threads++) {
+        if (pthread_create(&thread_ids[num_threads], NULL, process_job_thread, &pool) != 0) {
+            fprintf(stderr, "Failed to create worker thread %u\n", num_threads);
+            break;
         }
     }
 
-    for (size_t i = 0; i < job_count; i++) {
+    // the calling thread runs the jobs itself if no worker could start
+    if (num_threads == 0) {
+        process_job_thread(&pool);
+    }
+
+    for (unsigned int i = 0; i < num_threads; i++) {
         pthread_join(thread_ids[i], NULL);
     }
 
+    for (unsigned int i = 0; i < pool.job_count; i++) {
+        if (args[i].result != EXIT_SUCCESS) {
+            fprintf(stderr, "Job failed: %s.job\n", args[i].file_path_base);
+        }
+    }
+
     ret = EXIT_SUCCESS;
 
 cleanup:
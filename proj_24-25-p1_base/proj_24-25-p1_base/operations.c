@@ -65,24 +65,39 @@ int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_
   return 0;
 }
 
+// Orders pointers to keys by the keys they point to.
+static int compare_key_ptrs(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
 int kvs_read(int fd, size_t num_pairs, char keys[][MAX_STRING_SIZE]) {
     if (kvs_table == NULL) {
         fprintf(stderr, "KVS state must be initialized\n");
         return 1;
     }
 
-    // Sort the keys array in ascending lexicographical order
-    qsort(keys, num_pairs, MAX_STRING_SIZE, compare_strings);
+    if (num_pairs > MAX_WRITE_SIZE) {
+        fprintf(stderr, "Too many keys to read\n");
+        return 1;
+    }
+
+    // Output goes in ascending lexicographical order; sort pointers to the
+    // keys so the caller's array is left as it is
+    const char *sorted[MAX_WRITE_SIZE];
+    for (size_t i = 0; i < num_pairs; i++) {
+        sorted[i] = keys[i];
+    }
+    qsort(sorted, num_pairs, sizeof(sorted[0]), compare_key_ptrs);
 
-    keys_wrlock(kvs_table, num_pairs, keys);
+    keys_rdlock(kvs_table, num_pairs, keys);
 
     dprintf(fd, "[");
     for (size_t i = 0; i < num_pairs; i++) {
-        char *result = read_pair(kvs_table, keys[i]);
+        char *result = read_pair(kvs_table, sorted[i]);
         if (result == NULL) {
-            dprintf(fd, "(%s,KVSERROR)", keys[i]);
+            dprintf(fd, "(%s,KVSERROR)", sorted[i]);
         } else {
-            dprintf(fd, "(%s,%s)", keys[i], result);
+            dprintf(fd, "(%s,%s)", sorted[i], result);
         }
         free(result);
     }
@@ -39,6 +39,11 @@ size_t parse_write(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRIN
 /// @return Number of keys read or deleted. 0 on failure.
 size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size);
 
+/// Drops the input buffered from fd, which must be called before closing a
+/// job file that was not parsed to its end, as its descriptor may be reused.
+/// @param fd File descriptor being parsed.
+void parser_reset(int fd);
+
 /// Parses a WAIT command.
 /// @param fd File descriptor to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
@@ -1,16 +1,24 @@
 #include "api.h"
 #include "../common/constants.h"
+#include "../common/io.h"
 #include "../common/protocol.h"
+#include "../common/ring.h"
 #include <fcntl.h>
 #include <stdlib.h>   
 #include <unistd.h>  
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <string.h>  
 #include <stdio.h>
 #include <errno.h>
 
-#define FIELD_SIZE 40
-#define REQUEST_BUFFER_SIZE (1 + FIELD_SIZE * 3)
+// Requests sent before their responses are read, few and small enough that
+// they fit in the request pipe together, so sending never waits on the
+// server while it waits for the client to read responses.
+#define MAX_IN_FLIGHT 64
+#define REQUEST_WINDOW 65536 // bytes, the capacity of a pipe
 
 struct Connection {
   int req_pipe;
@@ -20,10 +28,42 @@ struct Connection {
   const char *req_pipe_path;
   const char *resp_pipe_path;
   const char *notif_pipe_path;
+
+  struct ShmChannel *shm; // rings shared with the server, NULL if none
 };
 
 struct Connection connection;
 
+// Response that arrived while the client was waiting for another one.
+struct Response {
+  struct FrameHeader header;
+  char *payload;
+  struct Response *next;
+};
+
+static uint32_t next_request_id = 0;
+static size_t in_flight = 0; // requests sent whose responses were not read
+static size_t in_flight_bytes = 0;
+// sizes of the requests in flight, oldest first, as the server answers the
+// requests of a session in order
+static size_t in_flight_sizes[MAX_IN_FLIGHT];
+static size_t oldest_in_flight = 0;
+static struct Response *early = NULL;
+static struct Response *early_tail = NULL;
+
+static struct ResumeRequest resume; // sent with the connect request
+static int resuming = 0;            // 1 if resume was set
+static uint64_t session_token = 0;
+static int session_resumed = 0;
+
+// Notifications read but not returned yet. A batch is at most
+// MAX_NOTIFICATION_BATCH bytes and a notification split across batches is
+// shorter than one, so a batch always fits after what is left.
+static char notif_buf[2 * MAX_NOTIFICATION_BATCH];
+static size_t notif_start = 0;
+static size_t notif_len = 0;
+static uint32_t last_seq = 0; // of the last notification returned
+
 int make_pipe(char const *pipe_path) { 
   unlink(pipe_path);
   if (mkfifo(pipe_path, 0666) < 0) {
@@ -45,46 +85,249 @@ int open_pipe(char const *pipe_path, int pipe_flags, int *fd_out) {
   return 0;
 }
 
-int read_response(int opcode) {
-  char buf[2];
-  char buf2[12];
-  ssize_t n = read(connection.resp_pipe, buf, 2);
-  
-  if (n < 2) {
+// Sends a request, through the request ring when memory is shared with the
+// server, ringing the socket only if the server went idle.
+static ssize_t send_request(const void *buf, size_t len) {
+  if (connection.shm == NULL) {
+    return write(connection.req_pipe, buf, len);
+  }
+
+  if (ring_push(&connection.shm->req, buf, len) != 0) {
+    errno = EAGAIN;
     return -1;
   }
-  
-switch (buf[0]) {
-        case '1': strcpy(buf2, "CONNECT"); break;
-        case '2': strcpy(buf2, "DISCONNECT"); break;
-        case '3': strcpy(buf2, "SUBSCRIBE"); break;
-        case '4': strcpy(buf2, "UNSUBSCRIBE"); break;
-        default: strcpy(buf2, "UNKNOWN"); break;
+  if (ring_notify(&connection.shm->req) && write(connection.req_pipe, "", 1) < 0) {
+    return -1;
   }
+  return (ssize_t)len;
+}
 
+// Reads the next response from the server.
+// @param header Set to the header of the response.
+// @param payload Set to the payload, at least MAX_FRAME_PAYLOAD bytes.
+// @return 0 on success, 1 otherwise.
+static int receive_response(struct FrameHeader *header, char *payload) {
+  char buf[MAX_FRAME_SIZE];
+  ssize_t n;
+
+  if (connection.shm != NULL) {
+    n = ring_wait_pop(&connection.shm->resp, buf, sizeof(buf));
+    // the server holds responses back while the ring is full
+    if (n > 0 && ring_made_room(&connection.shm->resp) &&
+        write(connection.req_pipe, "", 1) < 0) {
+      return 1;
+    }
+  } else if (connection.req_pipe_path == NULL) {
+    // each socket message is a whole response
+    n = read(connection.resp_pipe, buf, sizeof(buf));
+  } else {
+    if (read_all(connection.resp_pipe, header, FRAME_HEADER_SIZE, NULL) != 1 ||
+        header->length > MAX_FRAME_PAYLOAD ||
+        (header->length > 0 &&
+         read_all(connection.resp_pipe, payload, header->length, NULL) != 1)) {
+      return 1;
+    }
+    return 0;
+  }
 
-printf("Server returned %c for operation: %s\n", buf[1], buf2);
+  if (n < (ssize_t)FRAME_HEADER_SIZE) {
+    return 1;
+  }
+  memcpy(header, buf, FRAME_HEADER_SIZE);
+  if (header->length > (size_t)n - FRAME_HEADER_SIZE) {
+    return 1;
+  }
+  memcpy(payload, buf + FRAME_HEADER_SIZE, header->length);
+  return 0;
+}
 
+// Reads the next response and keeps it for kvs_wait.
+// @return 0 on success, 1 otherwise.
+static int receive_early(void) {
+  char payload[MAX_FRAME_PAYLOAD];
+  struct Response *response = malloc(sizeof(struct Response));
 
-  if (buf[0] != '0' + opcode) {
-    return -1;
+  if (response == NULL || receive_response(&response->header, payload) != 0) {
+    free(response);
+    return 1;
   }
+  in_flight--;
+  in_flight_bytes -= in_flight_sizes[oldest_in_flight];
+  oldest_in_flight = (oldest_in_flight + 1) % MAX_IN_FLIGHT;
 
-  return buf[1];
+  response->payload = malloc(response->header.length);
+  if (response->payload == NULL && response->header.length > 0) {
+    free(response);
+    return 1;
+  }
+  memcpy(response->payload, payload, response->header.length);
+  response->next = NULL;
+  if (early_tail != NULL) {
+    early_tail->next = response;
+  } else {
+    early = response;
+  }
+  early_tail = response;
+  return 0;
 }
 
-int send_message(int opcode, char *message_buf) {
-  message_buf[0] = '0' + (char)opcode;
+// Prints the outcome of a request.
+static void report_response(const struct FrameHeader *header) {
+  const char *name;
+
+  switch (header->opcode) {
+    case OP_CODE_CONNECT: name = "CONNECT"; break;
+    case OP_CODE_DISCONNECT: name = "DISCONNECT"; break;
+    case OP_CODE_SUBSCRIBE: name = "SUBSCRIBE"; break;
+    case OP_CODE_UNSUBSCRIBE: name = "UNSUBSCRIBE"; break;
+    case OP_CODE_GET: name = "GET"; break;
+    case OP_CODE_PUT: name = "PUT"; break;
+    case OP_CODE_DEL: name = "DEL"; break;
+    case OP_CODE_MGET: name = "MGET"; break;
+    case OP_CODE_MSET: name = "MSET"; break;
+    case OP_CODE_NOTIFY: name = "NOTIFY"; break;
+    default: name = "UNKNOWN"; break;
+  }
+
+  printf("Server returned %d for operation: %s\n", header->result, name);
+}
 
-  if (write(connection.req_pipe, message_buf, sizeof(message_buf)) < 0) {
+int kvs_send(int opcode, const void *payload, size_t len,
+             uint32_t *request_id) {
+  char buf[MAX_FRAME_SIZE];
+
+  if (len > MAX_FRAME_PAYLOAD) {
+    fprintf(stderr, "Request too long\n");
+    return 1;
+  }
+  size_t size = FRAME_HEADER_SIZE + len;
+  while (in_flight > 0 && (in_flight == MAX_IN_FLIGHT ||
+                           in_flight_bytes + size > REQUEST_WINDOW)) {
+    if (receive_early() != 0) {
+      fprintf(stderr, "Error reading response from server\n");
+      return 1;
+    }
+  }
+
+  struct FrameHeader header = {.length = (uint32_t)len,
+                               .request_id = next_request_id++,
+                               .opcode = (uint8_t)opcode};
+  memcpy(buf, &header, FRAME_HEADER_SIZE);
+  if (len > 0) {
+    memcpy(buf + FRAME_HEADER_SIZE, payload, len);
+  }
+
+  // a ring also stores the length of each request, so it may fill up
+  // before the window does
+  ssize_t sent;
+  while ((sent = send_request(buf, size)) < 0 && errno == EAGAIN &&
+         in_flight > 0) {
+    if (receive_early() != 0) {
+      fprintf(stderr, "Error reading response from server\n");
+      return 1;
+    }
+  }
+  if (sent < 0) {
     perror("Error sending request to server");
     return 1;
   }
 
-  read_response(opcode);
+  in_flight_sizes[(oldest_in_flight + in_flight) % MAX_IN_FLIGHT] = size;
+  in_flight++;
+  in_flight_bytes += size;
+  *request_id = header.request_id;
   return 0;
 }
 
+int kvs_wait(uint32_t request_id, void *payload, size_t size, size_t *len) {
+  struct Response *response = NULL;
+  struct Response *prev = NULL;
+
+  for (response = early; response != NULL; response = response->next) {
+    if (response->header.request_id == request_id) {
+      break;
+    }
+    prev = response;
+  }
+
+  if (response != NULL) {
+    if (prev != NULL) {
+      prev->next = response->next;
+    } else {
+      early = response->next;
+    }
+    if (early_tail == response) {
+      early_tail = prev;
+    }
+  } else {
+    // responses to other requests are kept until they are waited for
+    while (early_tail == NULL || early_tail->header.request_id != request_id) {
+      if (receive_early() != 0) {
+        fprintf(stderr, "Error reading response from server\n");
+        return -1;
+      }
+    }
+    return kvs_wait(request_id, payload, size, len);
+  }
+
+  report_response(&response->header);
+  if (payload != NULL) {
+    memcpy(payload, response->payload,
+           response->header.length < size ? response->header.length : size);
+  }
+  if (len != NULL) {
+    *len = response->header.length;
+  }
+
+  int result = response->header.result;
+  free(response->payload);
+  free(response);
+  return result;
+}
+
+// Sends a request and waits for its response.
+// @return 0 if the server answered, 1 otherwise.
+static int send_message(int opcode, const void *payload, size_t len) {
+  uint32_t request_id;
+
+  if (kvs_send(opcode, payload, len, &request_id) != 0 ||
+      kvs_wait(request_id, NULL, 0, NULL) < 0) {
+    return 1;
+  }
+  return 0;
+}
+
+// Waits for the response to the connect request and keeps the session it
+// describes.
+// @return 0 if the server accepted the client, 1 otherwise.
+static int wait_connect(uint32_t request_id) {
+  struct ConnectResponse response = {0};
+
+  if (kvs_wait(request_id, &response, sizeof(response), NULL) != 0) {
+    return 1;
+  }
+  session_token = response.token;
+  session_resumed = response.resumed;
+  if (!session_resumed) {
+    // a new session numbers its notifications from the start
+    last_seq = 0;
+  }
+  return 0;
+}
+
+void kvs_resume(uint64_t token, uint32_t seq) {
+  resume.token = token;
+  resume.last_seq = seq;
+  resume.reserved = 0;
+  resuming = 1;
+  last_seq = seq;
+}
+
+uint64_t kvs_session_token(int *resumed) {
+  *resumed = session_resumed;
+  return session_token;
+}
+
 int kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
                 char const *server_pipe_path, char const *notif_pipe_path, int *notif_fd) {
   int fserv;
@@ -104,15 +347,25 @@ int kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
     return 1;
   }
   
-  char buffer[121] = {0};
-
-  // Copy OP_CODE to the buffer
-  buffer[0] = '0' + OP_CODE_CONNECT;
-  strcpy(buffer + 1, req_pipe_path);
-  strcpy(buffer + 41, resp_pipe_path);
-  strcpy(buffer + 81, notif_pipe_path);
+  char buffer[FRAME_HEADER_SIZE + 3 * MAX_PIPE_PATH_LENGTH +
+              sizeof(struct ResumeRequest)] = {0};
+  size_t len = 3 * MAX_PIPE_PATH_LENGTH;
+  char *paths = buffer + FRAME_HEADER_SIZE;
+  if (resuming) {
+    memcpy(paths + len, &resume, sizeof(resume));
+    len += sizeof(resume);
+  }
+  struct FrameHeader header = {.length = (uint32_t)len,
+                               .request_id = next_request_id++,
+                               .opcode = OP_CODE_CONNECT};
+
+  memcpy(buffer, &header, FRAME_HEADER_SIZE);
+  strncpy(paths, req_pipe_path, MAX_PIPE_PATH_LENGTH);
+  strncpy(paths + MAX_PIPE_PATH_LENGTH, resp_pipe_path, MAX_PIPE_PATH_LENGTH);
+  strncpy(paths + 2 * MAX_PIPE_PATH_LENGTH, notif_pipe_path,
+          MAX_PIPE_PATH_LENGTH);
   
-  if (write(fserv, buffer, sizeof(buffer)) < 0) {
+  if (write(fserv, buffer, FRAME_HEADER_SIZE + len) < 0) {
     perror("Error writing to server pipe");
     return 1;
   }
@@ -129,7 +382,9 @@ int kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
 
   fflush(stdout);
 
-  if (read_response(OP_CODE_CONNECT) != '0') {
+  in_flight_sizes[oldest_in_flight] = 0; // not in the request pipe
+  in_flight++;
+  if (wait_connect(header.request_id) != 0) {
     return 1;
   }
 
@@ -141,17 +396,264 @@ int kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
   return 0;
 }
 
+// Connects to the server socket and sends the connect request, passing the
+// file descriptor the server will notify the client through.
+// @param request_id Set to the id of the connect request.
+// @return The connected socket, -1 on failure.
+static int connect_socket(char const *server_socket_path, int notif_fd,
+                          uint32_t *request_id) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int sock;
+
+  if (strlen(server_socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", server_socket_path);
+    return -1;
+  }
+  strcpy(addr.sun_path, server_socket_path);
+
+  if ((sock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0) {
+    perror("Error creating socket");
+    return -1;
+  }
+
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("Error connecting to server");
+    close(sock);
+    return -1;
+  }
+
+  struct FrameHeader request = {
+      .length = resuming ? (uint32_t)sizeof(resume) : 0,
+      .request_id = next_request_id++,
+      .opcode = OP_CODE_CONNECT};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct iovec iov[2] = {{.iov_base = &request, .iov_len = FRAME_HEADER_SIZE},
+                         {.iov_base = &resume, .iov_len = request.length}};
+  struct msghdr msg = {.msg_iov = iov,
+                       .msg_iovlen = resuming ? 2 : 1,
+                       .msg_control = control.buf,
+                       .msg_controllen = sizeof(control.buf)};
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &notif_fd, sizeof(int));
+
+  if (sendmsg(sock, &msg, 0) < 0) {
+    perror("Error writing to server socket");
+    close(sock);
+    return -1;
+  }
+
+  in_flight_sizes[oldest_in_flight] = 0; // not counted against the window
+  in_flight++;
+  *request_id = request.request_id;
+  return sock;
+}
+
+int kvs_connect_socket(char const *server_socket_path, int *notif_fd) {
+  int notif_pair[2];
+  uint32_t request_id;
+  int sock;
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, notif_pair) < 0) {
+    perror("Error creating notification socket");
+    return 1;
+  }
+
+  // the server keeps notif_pair[1] and writes the notifications to it
+  sock = connect_socket(server_socket_path, notif_pair[1], &request_id);
+  close(notif_pair[1]);
+  if (sock < 0) {
+    close(notif_pair[0]);
+    return 1;
+  }
+
+  connection.req_pipe = sock;
+  connection.resp_pipe = sock;
+  connection.notif_pipe = notif_pair[0];
+  connection.req_pipe_path = NULL;
+  connection.resp_pipe_path = NULL;
+  connection.notif_pipe_path = NULL;
+  connection.shm = NULL;
+
+  *notif_fd = connection.notif_pipe;
+
+  if (wait_connect(request_id) != 0) {
+    return 1;
+  }
+
+  printf("Connection ready\n");
+  fflush(stdout);
+  return 0;
+}
+
+int kvs_connect_shm(char const *server_socket_path, int *notif_fd) {
+  char name[32];
+  snprintf(name, sizeof(name), "/kvs-%ld", (long)getpid());
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    perror("Error creating shared memory");
+    return 1;
+  }
+  // the segment lives on through the file descriptors
+  shm_unlink(name);
+
+  void *shm = MAP_FAILED;
+  if (ftruncate(fd, sizeof(struct ShmChannel)) < 0 ||
+      (shm = mmap(NULL, sizeof(struct ShmChannel), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    perror("Error mapping shared memory");
+    close(fd);
+    return 1;
+  }
+
+  struct ShmChannel *channel = shm;
+  ring_init(&channel->req);
+  ring_init(&channel->resp);
+  ring_init(&channel->notif);
+
+  uint32_t request_id;
+  int sock = connect_socket(server_socket_path, fd, &request_id);
+  if (sock < 0) {
+    munmap(shm, sizeof(struct ShmChannel));
+    close(fd);
+    return 1;
+  }
+
+  connection.req_pipe = sock;
+  connection.resp_pipe = sock;
+  connection.notif_pipe = fd;
+  connection.req_pipe_path = NULL;
+  connection.resp_pipe_path = NULL;
+  connection.notif_pipe_path = NULL;
+
+  *notif_fd = connection.notif_pipe;
+
+  // the connect response comes through the socket, the rest through the rings
+  if (wait_connect(request_id) != 0) {
+    return 1;
+  }
+  connection.shm = channel;
+
+  printf("Connection ready\n");
+  fflush(stdout);
+  return 0;
+}
+
+// Reads a key or value of a notification.
+// @param payload The payload of the notification.
+// @param len Length of the payload.
+// @param pos Position of the string, moved past it.
+// @param str Set to the string, MAX_STRING_SIZE + 1 bytes.
+// @return 0 on success, 1 if the payload is invalid.
+static int parse_string(const char *payload, size_t len, size_t *pos,
+                        char *str) {
+  if (*pos >= len) {
+    return 1;
+  }
+  size_t str_len = (unsigned char)payload[(*pos)++];
+  if (str_len > MAX_STRING_SIZE || *pos + str_len > len) {
+    return 1;
+  }
+  memcpy(str, payload + *pos, str_len);
+  str[str_len] = '\0';
+  *pos += str_len;
+  return 0;
+}
+
+// Parses the payload of a NOTIFY frame.
+// @return 0 on success, 1 if the payload is invalid.
+static int parse_notification(const char *payload, size_t len,
+                              struct Notification *notification) {
+  size_t pos = sizeof(notification->version);
+
+  if (len < pos) {
+    return 1;
+  }
+  memcpy(&notification->version, payload, pos);
+  if (parse_string(payload, len, &pos, notification->key) != 0 || pos >= len) {
+    return 1;
+  }
+
+  notification->deleted = (unsigned char)payload[pos] == FRAME_MISSING;
+  if (notification->deleted) {
+    notification->value[0] = '\0';
+    return pos + 1 == len ? 0 : 1;
+  }
+  return parse_string(payload, len, &pos, notification->value) != 0 ||
+         pos != len;
+}
+
+int kvs_next_notification(struct Notification *notification) {
+  for (;;) {
+    struct FrameHeader header;
+    if (notif_len >= FRAME_HEADER_SIZE) {
+      memcpy(&header, notif_buf + notif_start, FRAME_HEADER_SIZE);
+      if (header.length > MAX_NOTIFICATION_BATCH) {
+        fprintf(stderr, "Invalid notification from server\n");
+        errno = EPROTO;
+        return -1;
+      }
+    }
+
+    if (notif_len >= FRAME_HEADER_SIZE &&
+        notif_len - FRAME_HEADER_SIZE >= header.length) {
+      const char *payload = notif_buf + notif_start + FRAME_HEADER_SIZE;
+      notif_start += FRAME_HEADER_SIZE + header.length;
+      notif_len -= FRAME_HEADER_SIZE + header.length;
+
+      if (header.opcode != OP_CODE_NOTIFY ||
+          parse_notification(payload, header.length, notification) != 0) {
+        fprintf(stderr, "Invalid notification from server\n");
+        continue;
+      }
+      // the server skips a sequence number for each change it dropped
+      notification->seq = header.request_id;
+      notification->missed = header.request_id - last_seq - 1;
+      last_seq = header.request_id;
+      return 1;
+    }
+
+    memmove(notif_buf, notif_buf + notif_start, notif_len);
+    notif_start = 0;
+
+    ssize_t n;
+    if (connection.shm != NULL) {
+      n = ring_wait_pop(&connection.shm->notif, notif_buf + notif_len,
+                        sizeof(notif_buf) - notif_len);
+    } else {
+      n = read(connection.notif_pipe, notif_buf + notif_len,
+               sizeof(notif_buf) - notif_len);
+    }
+    if (n <= 0) {
+      return (int)n;
+    }
+    notif_len += (size_t)n;
+  }
+}
+
 int kvs_disconnect(void) {
-  char buffer[1] = {0};
-  send_message(OP_CODE_DISCONNECT, buffer);
+  send_message(OP_CODE_DISCONNECT, NULL, 0);
 
   close(connection.req_pipe);
-  close(connection.resp_pipe);
+  if (connection.resp_pipe != connection.req_pipe) {
+    close(connection.resp_pipe);
+  }
+  // the notification thread may still be reading the rings, so the segment
+  // stays mapped until the client exits
   close(connection.notif_pipe);
 
-  unlink(connection.req_pipe_path);
-  unlink(connection.resp_pipe_path);
-  unlink(connection.notif_pipe_path);
+  // a socket connection has no pipe files
+  if (connection.req_pipe_path != NULL) {
+    unlink(connection.req_pipe_path);
+    unlink(connection.resp_pipe_path);
+    unlink(connection.notif_pipe_path);
+  }
 
   // close pipes and unlink pipe files
   return 0;
@@ -159,15 +661,140 @@ int kvs_disconnect(void) {
 
 
 int kvs_subscribe(const char *key) {
-  char buffer[42] = {0};
-  strcpy(buffer + 1, key);
-
-  return send_message(OP_CODE_SUBSCRIBE, buffer);
+  return send_message(OP_CODE_SUBSCRIBE, key, strlen(key));
 }
 
 int kvs_unsubscribe(const char *key) {
-  char buffer[42] = {0};
-  strcpy(buffer + 1, key);
+  return send_message(OP_CODE_UNSUBSCRIBE, key, strlen(key));
+}
+
+// Appends a key or value to the payload of a request.
+// @param buf The payload, with room for the string.
+// @param len Length of the payload so far, moved past the string.
+// @return 0 on success, 1 if the string is too long.
+static int append_string(char *buf, size_t *len, const char *str) {
+  size_t str_len = strlen(str);
+
+  if (str_len > MAX_STRING_SIZE || *len + 1 + str_len > MAX_FRAME_PAYLOAD) {
+    fprintf(stderr, "Key or value too long: %s\n", str);
+    return 1;
+  }
+  buf[(*len)++] = (char)str_len;
+  memcpy(buf + *len, str, str_len);
+  *len += str_len;
+  return 0;
+}
+
+int kvs_get(const char *key, char *value) {
+  char payload[1 + MAX_STRING_SIZE];
+  size_t len = 0;
+  uint32_t request_id;
+
+  if (append_string(payload, &len, key) != 0 ||
+      kvs_send(OP_CODE_GET, payload, len, &request_id) != 0) {
+    return -1;
+  }
+
+  int result = kvs_wait(request_id, value, MAX_STRING_SIZE - 1, &len);
+  if (result == 0) {
+    value[len < MAX_STRING_SIZE - 1 ? len : MAX_STRING_SIZE - 1] = '\0';
+  }
+  return result;
+}
+
+int kvs_put(const char *key, const char *value) {
+  char payload[2 * (1 + MAX_STRING_SIZE)];
+  size_t len = 0;
+  uint32_t request_id;
+
+  if (append_string(payload, &len, key) != 0 ||
+      append_string(payload, &len, value) != 0 ||
+      kvs_send(OP_CODE_PUT, payload, len, &request_id) != 0) {
+    return -1;
+  }
+  return kvs_wait(request_id, NULL, 0, NULL);
+}
+
+int kvs_del(size_t num_keys, char keys[][MAX_STRING_SIZE], int missing[]) {
+  char payload[MAX_FRAME_PAYLOAD];
+  size_t len = 0;
+  uint32_t request_id;
+
+  for (size_t i = 0; i < num_keys; i++) {
+    if (append_string(payload, &len, keys[i]) != 0) {
+      return -1;
+    }
+  }
+  if (kvs_send(OP_CODE_DEL, payload, len, &request_id) != 0) {
+    return -1;
+  }
+
+  int result = kvs_wait(request_id, payload, sizeof(payload), &len);
+
+  // the response lists the missing keys, in the order they were sent
+  size_t pos = 0;
+  for (size_t i = 0; i < num_keys; i++) {
+    size_t key_len = strlen(keys[i]);
+    missing[i] = result == 1 && pos < len &&
+                 (unsigned char)payload[pos] == key_len &&
+                 memcmp(payload + pos + 1, keys[i], key_len) == 0;
+    if (missing[i]) {
+      pos += 1 + key_len;
+    }
+  }
+  return result;
+}
+
+int kvs_mget(size_t num_keys, char keys[][MAX_STRING_SIZE],
+             char values[][MAX_STRING_SIZE], int found[]) {
+  char payload[MAX_FRAME_PAYLOAD];
+  size_t len = 0;
+  uint32_t request_id;
+
+  for (size_t i = 0; i < num_keys; i++) {
+    if (append_string(payload, &len, keys[i]) != 0) {
+      return -1;
+    }
+  }
+  if (kvs_send(OP_CODE_MGET, payload, len, &request_id) != 0) {
+    return -1;
+  }
 
-  return send_message(OP_CODE_UNSUBSCRIBE, buffer);
+  int result = kvs_wait(request_id, payload, sizeof(payload), &len);
+  if (result < 0) {
+    return result;
+  }
+
+  size_t pos = 0;
+  for (size_t i = 0; i < num_keys; i++) {
+    size_t value_len = pos < len ? (unsigned char)payload[pos++] : FRAME_MISSING;
+    found[i] = value_len != FRAME_MISSING && pos + value_len <= len;
+    values[i][0] = '\0';
+    if (found[i]) {
+      size_t copied = value_len < MAX_STRING_SIZE - 1 ? value_len
+                                                      : MAX_STRING_SIZE - 1;
+      memcpy(values[i], payload + pos, copied);
+      values[i][copied] = '\0';
+      pos += value_len;
+    }
+  }
+  return result;
+}
+
+int kvs_mset(size_t num_pairs, char keys[][MAX_STRING_SIZE],
+             char values[][MAX_STRING_SIZE]) {
+  char payload[MAX_FRAME_PAYLOAD];
+  size_t len = 0;
+  uint32_t request_id;
+
+  for (size_t i = 0; i < num_pairs; i++) {
+    if (append_string(payload, &len, keys[i]) != 0 ||
+        append_string(payload, &len, values[i]) != 0) {
+      return -1;
+    }
+  }
+  if (kvs_send(OP_CODE_MSET, payload, len, &request_id) != 0) {
+    return -1;
+  }
+  return kvs_wait(request_id, NULL, 0, NULL);
 }
@@ -2,6 +2,8 @@
 #define CLIENT_API_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #include "../common/constants.h"
 
@@ -12,6 +14,71 @@
 /// @return 0 if the connection was established successfully, 1 otherwise.
 int kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
                 char const *server_pipe_path, char const *notif_pipe_path, int *notif_fd);
+/// Connects to a kvs server through its Unix socket. Requests and responses
+/// go through one socket and notifications through a second one, which is
+/// sent to the server with the connect request.
+/// @param server_socket_path Path of the socket where the server is listening.
+/// @param notif_fd Set to the socket to read notifications from.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+int kvs_connect_socket(char const *server_socket_path, int *notif_fd);
+/// Connects to a kvs server through its Unix socket, sharing a memory
+/// segment with it. Requests, responses and notifications go through rings
+/// in the segment, and the socket only wakes the server up when it is idle.
+/// @param server_socket_path Path of the socket where the server is listening.
+/// @param notif_fd Set to the file descriptor of the segment.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+int kvs_connect_shm(char const *server_socket_path, int *notif_fd);
+
+/// Asks the next connect to resume a session that lost its connection,
+/// instead of starting a new one. The server sends the notifications the
+/// client missed again, as long as it still has them all; otherwise the
+/// client gets a new session.
+/// @param token Token of the session, from kvs_session_token.
+/// @param last_seq Sequence number of the last notification received, 0 to
+/// get every notification the server kept.
+void kvs_resume(uint64_t token, uint32_t last_seq);
+
+/// Returns the token that identifies the session, to resume it later.
+/// @param resumed Set to 1 if the connect resumed a session, 0 otherwise.
+/// @return The token.
+uint64_t kvs_session_token(int *resumed);
+
+/// A change to a subscribed key.
+struct Notification {
+  uint32_t seq;     // sequence number of the notification
+  uint32_t missed;  // changes the server dropped since the last notification
+  uint64_t version; // version of the key after the change
+  int deleted;      // 1 if the key was deleted, with an empty value
+  char key[MAX_STRING_SIZE + 1];
+  char value[MAX_STRING_SIZE + 1];
+};
+
+/// Waits for the next notification.
+/// @param notification Set to the notification.
+/// @return 1 if a notification was read, 0 once the server closed the
+/// connection, -1 on error.
+int kvs_next_notification(struct Notification *notification);
+
+/// Sends a request without waiting for its response, so that several
+/// requests can be in flight at once. After a few requests in flight, this
+/// reads the oldest response first and keeps it for kvs_wait.
+/// @param opcode Opcode of the request (see ../common/protocol.h).
+/// @param payload Payload of the request.
+/// @param len Length of the payload, at most MAX_FRAME_PAYLOAD.
+/// @param request_id Set to the id to wait for the response with.
+/// @return 0 if the request was sent, 1 otherwise.
+int kvs_send(int opcode, const void *payload, size_t len,
+             uint32_t *request_id);
+
+/// Waits for the response to a request sent with kvs_send. Responses may be
+/// waited for in any order.
+/// @param request_id Id of the request.
+/// @param payload Where to copy the payload of the response, or NULL.
+/// @param size Size of payload; a longer payload is truncated.
+/// @param len Set to the length of the payload, if not NULL.
+/// @return The result the server returned, -1 if the connection failed.
+int kvs_wait(uint32_t request_id, void *payload, size_t size, size_t *len);
+
 /// Disconnects from an KVS server.
 /// @return 0 in case of success, 1 otherwise.
 int kvs_disconnect(void);
@@ -30,4 +97,44 @@ int kvs_subscribe(const char *key);
 
 int kvs_unsubscribe(const char *key);
 
+/// Reads the value of a key.
+/// @param key The key.
+/// @param value Set to the value, MAX_STRING_SIZE bytes.
+/// @return 0 if the key exists, 1 if it does not, -1 on error.
+int kvs_get(const char *key, char *value);
+
+/// Writes a key value pair, replacing the value if the key exists.
+/// @param key The key.
+/// @param value The value.
+/// @return 0 if the pair was written, 1 if the server refused it, -1 on
+/// error.
+int kvs_put(const char *key, const char *value);
+
+/// Deletes keys in a single request.
+/// @param num_keys Number of keys.
+/// @param keys The keys.
+/// @param missing Set to 1 for each key that did not exist, 0 otherwise.
+/// @return 0 if every key was deleted, 1 if some did not exist or the server
+/// refused the request, -1 on error.
+int kvs_del(size_t num_keys, char keys[][MAX_STRING_SIZE], int missing[]);
+
+/// Reads the values of keys in a single request.
+/// @param num_keys Number of keys.
+/// @param keys The keys.
+/// @param values Set to the values, empty for missing keys.
+/// @param found Set to 1 for each key that exists, 0 otherwise.
+/// @return 0 if every key exists, 1 if some do not or the server refused
+/// the request, -1 on error.
+int kvs_mget(size_t num_keys, char keys[][MAX_STRING_SIZE],
+             char values[][MAX_STRING_SIZE], int found[]);
+
+/// Writes key value pairs in a single request.
+/// @param num_pairs Number of pairs.
+/// @param keys The keys.
+/// @param values The values.
+/// @return 0 if the pairs were written, 1 if the server refused them, -1 on
+/// error.
+int kvs_mset(size_t num_pairs, char keys[][MAX_STRING_SIZE],
+             char values[][MAX_STRING_SIZE]);
+
 #endif // CLIENT_API_H
@@ -11,6 +11,7 @@
 #include "api.h"
 #include "../common/constants.h"
 #include "../common/io.h"
+#include "../common/protocol.h"
 
 typedef struct ThreadData {
     int notif_fd;
@@ -20,33 +21,60 @@ typedef struct ThreadData {
 void *notification_handler(void *arg) {
     ThreadData *data = (ThreadData *)arg;
     int notif_fd = data->notif_fd;
-    char notif_buf[256] = {0};
+    struct Notification notification;
 
     while (1) {
-        ssize_t bytes_read = read(notif_fd, notif_buf, sizeof(notif_buf) - 1);
+        int result = kvs_next_notification(&notification);
 
-        if (bytes_read > 0) {
-            notif_buf[bytes_read] = '\0'; // Null-terminate the string
-            printf("Notification received: %s\n", notif_buf);
-        } else if (bytes_read == 0) {
+        if (result > 0) {
+            if (notification.missed > 0) {
+                printf("Notifications missed: %u\n", notification.missed);
+            }
+            printf("Notification received: (%s,%s)\n", notification.key,
+                   notification.deleted ? "DELETED" : notification.value);
+        } else if (result == 0) {
             printf("SIGUSR1 close");
             _exit(0);
-        } else if (bytes_read < 0 && errno != EAGAIN) {
+        } else if (errno != EAGAIN) {
             perror("Error reading notification pipe");
             printf("Error occurred on FD: %d\n", notif_fd);
             break;
         }
-
-        memset(notif_buf, 0, sizeof(notif_buf)); // Clear buffer
     }
 
     return NULL;
 }
 
+// Sends a request for each key before waiting for any of the responses, so
+// the keys cost one round trip to the server instead of one each.
+static int request_keys(int opcode, char keys[][MAX_STRING_SIZE], size_t num) {
+    uint32_t request_ids[MAX_NUMBER_SUB];
+    size_t sent;
+    int failed = 0;
+
+    for (sent = 0; sent < num; sent++) {
+        if (kvs_send(opcode, keys[sent], strlen(keys[sent]), &request_ids[sent])) {
+            failed = 1;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < sent; i++) {
+        if (kvs_wait(request_ids[i], NULL, 0, NULL) < 0) {
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
+
 // Thread function to handle commands
 void *command_handler() {
     while (1) {
-        char keys[MAX_NUMBER_SUB][MAX_STRING_SIZE] = {0};
+        char keys[MAX_BATCH_KEYS][MAX_STRING_SIZE] = {0};
+        char values[MAX_BATCH_KEYS][MAX_STRING_SIZE] = {0};
+        int found[MAX_BATCH_KEYS];
+        int missing[MAX_BATCH_KEYS];
         unsigned int delay_ms;
         size_t num;
 
@@ -62,31 +90,83 @@ void *command_handler() {
             break;
 
         case CMD_SUBSCRIBE:
-            num = parse_list(STDIN_FILENO, keys, 1, MAX_STRING_SIZE);
+            num = parse_list(STDIN_FILENO, keys, MAX_NUMBER_SUB, MAX_STRING_SIZE);
             if (num == 0) {
                 fprintf(stderr, "Invalid command. See HELP for usage\n");
                 continue;
             }
 
-            if (kvs_subscribe(keys[0])) {
+            if (request_keys(OP_CODE_SUBSCRIBE, keys, num)) {
                 fprintf(stderr, "Command subscribe failed\n");
             }
 
             break;
 
         case CMD_UNSUBSCRIBE:
-            num = parse_list(STDIN_FILENO, keys, 1, MAX_STRING_SIZE);
+            num = parse_list(STDIN_FILENO, keys, MAX_NUMBER_SUB, MAX_STRING_SIZE);
             if (num == 0) {
                 fprintf(stderr, "Invalid command. See HELP for usage\n");
                 continue;
             }
 
-            if (kvs_unsubscribe(keys[0])) {
+            if (request_keys(OP_CODE_UNSUBSCRIBE, keys, num)) {
                 fprintf(stderr, "Command unsubscribe failed\n");
             }
 
             break;
 
+        case CMD_GET:
+            num = parse_list(STDIN_FILENO, keys, MAX_BATCH_KEYS, MAX_STRING_SIZE);
+            if (num == 0) {
+                fprintf(stderr, "Invalid command. See HELP for usage\n");
+                continue;
+            }
+
+            if (kvs_mget(num, keys, values, found) < 0) {
+                fprintf(stderr, "Command get failed\n");
+                break;
+            }
+
+            printf("[");
+            for (size_t i = 0; i < num; i++) {
+                printf("(%s,%s)", keys[i], found[i] ? values[i] : "KVSERROR");
+            }
+            printf("]\n");
+            break;
+
+        case CMD_PUT:
+            num = parse_pairs(STDIN_FILENO, keys, values, MAX_BATCH_KEYS, MAX_STRING_SIZE);
+            if (num == 0) {
+                fprintf(stderr, "Invalid command. See HELP for usage\n");
+                continue;
+            }
+
+            if (kvs_mset(num, keys, values) != 0) {
+                fprintf(stderr, "Command put failed\n");
+            }
+            break;
+
+        case CMD_DEL:
+            num = parse_list(STDIN_FILENO, keys, MAX_BATCH_KEYS, MAX_STRING_SIZE);
+            if (num == 0) {
+                fprintf(stderr, "Invalid command. See HELP for usage\n");
+                continue;
+            }
+
+            int result = kvs_del(num, keys, missing);
+            if (result < 0) {
+                fprintf(stderr, "Command del failed\n");
+            } else if (result == 1) {
+                printf("[");
+                for (size_t i = 0; i < num; i++) {
+                    if (missing[i]) {
+                        printf("(%s,KVSMISSING)", keys[i]);
+                    }
+                }
+                printf("]\n");
+            }
+            break;
+
         case CMD_DELAY:
             if (parse_delay(STDIN_FILENO, &delay_ms) == -1) {
                 fprintf(stderr, "Invalid command. See HELP for usage\n");
@@ -116,8 +196,36 @@ void *command_handler() {
 }
 
 int main(int argc, char *argv[]) {
+    const char *program = argv[0];
+    int use_shm = 0;
+    unsigned long long token;
+    unsigned int last_seq = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "mr:")) != -1) {
+        switch (opt) {
+        case 'm':
+            use_shm = 1;
+            break;
+        case 'r':
+            if (sscanf(optarg, "%llu:%u", &token, &last_seq) < 1) {
+                fprintf(stderr, "Invalid session to resume: %s\n", optarg);
+                return 1;
+            }
+            kvs_resume(token, last_seq);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-m] [-r token[:seq]] <client_unique_id> <register_pipe_or_socket_path>\n", program);
+            return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc < 3) {
-        fprintf(stderr, "Usage: %s <client_unique_id> <register_pipe_path>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-m] [-r token[:seq]] <client_unique_id> <register_pipe_or_socket_path>\n"
+                        "  -m  share memory with the server (socket only)\n"
+                        "  -r  resume the session with that token, after notification seq\n", program);
         return 1;
     }
 
@@ -130,13 +238,24 @@ int main(int argc, char *argv[]) {
     strncat(resp_pipe_path, argv[1], strlen(argv[1]) * sizeof(char));
     strncat(notif_pipe_path, argv[1], strlen(argv[1]) * sizeof(char));
 
-    // Connect to the server
-    if (kvs_connect(req_pipe_path, resp_pipe_path, argv[2], notif_pipe_path, &notif_fd) == 1) {
+    // Connect to the server, through its socket if argv[2] is one
+    struct stat st;
+    int connected;
+    if (stat(argv[2], &st) == 0 && S_ISSOCK(st.st_mode)) {
+        connected = use_shm ? kvs_connect_shm(argv[2], &notif_fd)
+                            : kvs_connect_socket(argv[2], &notif_fd);
+    } else {
+        connected = kvs_connect(req_pipe_path, resp_pipe_path, argv[2], notif_pipe_path, &notif_fd);
+    }
+    if (connected == 1) {
         fflush(stdout);
         exit(1);
     }
 
+    int resumed;
+    token = kvs_session_token(&resumed);
     printf("Connected to server.\n");
+    printf("%s session %llu\n", resumed ? "Resumed" : "Started", token);
 
     // Create thread data
     ThreadData thread_data = {notif_fd};
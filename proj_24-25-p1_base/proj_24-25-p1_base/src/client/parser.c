@@ -116,20 +116,49 @@ enum Command get_next(int fd) {
 
     return CMD_UNSUBSCRIBE;
 
+  case 'G':
+    if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "GET ", 4) != 0) {
+      cleanup(fd);
+      return CMD_INVALID;
+    }
+
+    return CMD_GET;
+
+  case 'P':
+    if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "PUT ", 4) != 0) {
+      cleanup(fd);
+      return CMD_INVALID;
+    }
+
+    return CMD_PUT;
+
   case 'D':
-    if (read(fd, buf + 1, 5) != 5 || strncmp(buf, "DELAY ", 6) != 0) {
-      if (read(fd, buf + 6, 4) != 4 || strncmp(buf, "DISCONNECT", 10) != 0) {
-        cleanup(fd);
-        return CMD_INVALID;
-      }
-      if (read(fd, buf + 10, 1) != 0 && buf[10] != '\n') {
+    if (read(fd, buf + 1, 3) != 3) {
+      cleanup(fd);
+      return CMD_INVALID;
+    }
+
+    // DEL, DELAY and DISCONNECT share their first letters
+    if (strncmp(buf, "DEL ", 4) == 0) {
+      return CMD_DEL;
+    }
+    if (strncmp(buf, "DELA", 4) == 0) {
+      if (read(fd, buf + 4, 2) != 2 || strncmp(buf, "DELAY ", 6) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
-      return CMD_DISCONNECT;
+      return CMD_DELAY;
     }
 
-    return CMD_DELAY;
+    if (read(fd, buf + 4, 6) != 6 || strncmp(buf, "DISCONNECT", 10) != 0) {
+      cleanup(fd);
+      return CMD_INVALID;
+    }
+    if (read(fd, buf + 10, 1) != 0 && buf[10] != '\n') {
+      cleanup(fd);
+      return CMD_INVALID;
+    }
+    return CMD_DISCONNECT;
 
   case '#':
     cleanup(fd);
@@ -182,6 +211,40 @@ size_t parse_list(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
   return num_keys;
 }
 
+size_t parse_pairs(int fd, char keys[][MAX_STRING_SIZE],
+                   char values[][MAX_STRING_SIZE], size_t max_pairs,
+                   size_t max_string_size) {
+  char ch;
+
+  if (read(fd, &ch, 1) != 1 || ch != '[') {
+    cleanup(fd);
+    return 0;
+  }
+
+  size_t num_pairs = 0;
+  while (read(fd, &ch, 1) == 1 && ch == '(') {
+    if (num_pairs == max_pairs ||
+        read_string(fd, keys[num_pairs], max_string_size - 1) != 0 ||
+        read_string(fd, values[num_pairs], max_string_size - 1) != 1) {
+      cleanup(fd);
+      return 0;
+    }
+    num_pairs++;
+  }
+
+  if (ch != ']' || num_pairs == 0) {
+    cleanup(fd);
+    return 0;
+  }
+
+  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+    cleanup(fd);
+    return 0;
+  }
+
+  return num_pairs;
+}
+
 int parse_delay(int fd, unsigned int *delay) {
   char ch;
 
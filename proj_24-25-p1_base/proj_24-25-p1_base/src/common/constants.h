@@ -5,3 +5,5 @@
 #define MAX_PIPE_PATH_LENGTH 40 // tamanho max do caminho do pipe
 #define MAX_STRING_SIZE 40
 #define MAX_NUMBER_SUB 10
+#define MAX_BATCH_KEYS 256 // chaves max de um GET/PUT/DEL (MAX_WRITE_SIZE no server)
+#define MAX_NOTIFICATION_BATCH 4096 // bytes de notificacoes por escrita (PIPE_BUF)
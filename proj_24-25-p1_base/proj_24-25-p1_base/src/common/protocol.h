@@ -1,6 +1,9 @@
 #ifndef COMMON_PROTOCOL_H
 #define COMMON_PROTOCOL_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 // Opcodes for client-server communication
 // estes opcodes sao usados num switch case para determinar o que fazer com a
 // mensagem recebida no server usam estes opcodes tambem nos clientes quando
@@ -10,6 +13,75 @@ enum {
   OP_CODE_DISCONNECT = 2,
   OP_CODE_SUBSCRIBE = 3,
   OP_CODE_UNSUBSCRIBE = 4,
+  OP_CODE_GET = 5,
+  OP_CODE_PUT = 6,
+  OP_CODE_DEL = 7,
+  OP_CODE_MGET = 8,
+  OP_CODE_MSET = 9,
+  OP_CODE_NOTIFY = 10,
+};
+
+// Every request and response is a frame: a FrameHeader followed by length
+// bytes of payload. The client picks the request_id of each request and
+// the server copies it into the response, so a client may send several
+// requests before reading their responses and match them up by id.
+// Integers are in host byte order, both ends being on the same machine.
+//
+// Payloads:
+//   CONNECT      request on the server pipe: the request, response and
+//                notification pipe paths, MAX_PIPE_PATH_LENGTH bytes each and
+//                padded with '\0'; on a socket: empty, with the notification
+//                socket or shared-memory segment attached; either may be
+//                followed by a ResumeRequest; response: a ConnectResponse
+//   SUBSCRIBE,
+//   UNSUBSCRIBE  request: the key, without a terminating '\0', or a prefix
+//                followed by '*' for every key with it, even keys written
+//                later
+//   DISCONNECT   request: empty
+//   GET          request: the key; response: the value, result 1 if the key
+//                does not exist
+//   PUT          request: the key and the value
+//   DEL          request: the keys; response: the keys that did not exist,
+//                result 1 if there is any
+//   MGET         request: the keys; response: the value of each key,
+//                FRAME_MISSING instead of the length of a missing one,
+//                result 1 if there is any
+//   MSET         request: each key followed by its value
+//   responses    empty unless stated otherwise, with the outcome in result
+//   NOTIFY       sent on the notification channel, never a response: the
+//                request_id holds the sequence number of the frame, from 1
+//                up, skipping one for each change the server dropped; the
+//                payload is the 8-byte version of the key, the key, and its
+//                value or FRAME_MISSING if it was deleted
+//
+// Keys and values in GET, PUT, DEL, MGET, MSET and NOTIFY payloads are each
+// a byte with their length followed by their characters. The GET response
+// holds just the characters of the value.
+struct FrameHeader {
+  uint32_t length;     // bytes of payload after the header
+  uint32_t request_id; // chosen by the client, copied into the response
+  uint8_t opcode;
+  uint8_t result;      // 0 in requests, the outcome in responses
+  uint8_t reserved[2]; // 0
+};
+
+/// Asks the server to resume a session that lost its connection, keeping
+/// its subscriptions and sending the notifications after last_seq again.
+struct ResumeRequest {
+  uint64_t token;    // from the ConnectResponse of the session
+  uint32_t last_seq; // sequence number of the last notification received
+  uint32_t reserved; // 0
+};
+
+struct ConnectResponse {
+  uint64_t token;      // identifies the session to resume it
+  uint8_t resumed;     // 1 if a ResumeRequest was honoured
+  uint8_t reserved[7]; // 0
 };
 
+#define FRAME_HEADER_SIZE sizeof(struct FrameHeader)
+#define MAX_FRAME_PAYLOAD 24576 // room for MSET of MAX_WRITE_SIZE pairs
+#define MAX_FRAME_SIZE (FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD)
+#define FRAME_MISSING 0xFF
+
 #endif // COMMON_PROTOCOL_H
@@ -0,0 +1,145 @@
+// syscall is not part of POSIX
+#define _GNU_SOURCE
+
+#include "ring.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RING_HEADER 2 // bytes of the length of each message
+
+_Static_assert((RING_SIZE & (RING_SIZE - 1)) == 0,
+               "RING_SIZE must be a power of two");
+_Static_assert(RING_MAX_MESSAGE <= UINT16_MAX, "lengths are 2 bytes");
+
+// The rings live in memory shared between processes, so the futex calls
+// are not private.
+static void futex_wait(atomic_uint *word, unsigned int value) {
+  syscall(SYS_futex, word, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *word) {
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Copies bytes into the ring starting at a position, wrapping around.
+static void copy_in(struct Ring *ring, unsigned int pos, const void *src,
+                    size_t len) {
+  size_t start = pos & (RING_SIZE - 1);
+  size_t first = len < RING_SIZE - start ? len : RING_SIZE - start;
+  memcpy(ring->data + start, src, first);
+  memcpy(ring->data, (const char *)src + first, len - first);
+}
+
+// Copies bytes out of the ring starting at a position, wrapping around.
+static void copy_out(const struct Ring *ring, unsigned int pos, void *dest,
+                     size_t len) {
+  size_t start = pos & (RING_SIZE - 1);
+  size_t first = len < RING_SIZE - start ? len : RING_SIZE - start;
+  memcpy(dest, ring->data + start, first);
+  memcpy((char *)dest + first, ring->data, len - first);
+}
+
+// Tells whether a message of len bytes fits in the room left in a ring.
+static int fits(struct Ring *ring, size_t len) {
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  return len <= RING_MAX_MESSAGE &&
+         RING_SIZE - (head - tail) >= RING_HEADER + len;
+}
+
+void ring_init(struct Ring *ring) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->seq, 0);
+  atomic_init(&ring->sleeping, 0);
+  atomic_init(&ring->waiting, 0);
+  atomic_init(&ring->closed, 0);
+}
+
+int ring_push(struct Ring *ring, const void *msg, size_t len) {
+  if (!fits(ring, len)) {
+    return 1;
+  }
+
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint16_t header = (uint16_t)len;
+  copy_in(ring, head, &header, RING_HEADER);
+  copy_in(ring, head + RING_HEADER, msg, len);
+  atomic_store_explicit(&ring->head, head + RING_HEADER + (unsigned int)len,
+                        memory_order_release);
+  return 0;
+}
+
+int ring_has_room(struct Ring *ring, size_t len) {
+  if (fits(ring, len)) {
+    return 1;
+  }
+  // a pop before the flag is set is seen by the second check, and one after
+  // it sees the flag
+  atomic_store(&ring->waiting, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  return fits(ring, len);
+}
+
+int ring_made_room(struct Ring *ring) {
+  atomic_thread_fence(memory_order_seq_cst);
+  return atomic_load(&ring->waiting) && atomic_exchange(&ring->waiting, 0);
+}
+
+int ring_notify(struct Ring *ring) {
+  atomic_fetch_add(&ring->seq, 1);
+  if (atomic_load(&ring->sleeping)) {
+    futex_wake(&ring->seq);
+    return 1;
+  }
+  return 0;
+}
+
+ssize_t ring_pop(struct Ring *ring, void *buf, size_t size) {
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  if (head == tail) {
+    return -1;
+  }
+
+  uint16_t len;
+  copy_out(ring, tail, &len, RING_HEADER);
+  copy_out(ring, tail + RING_HEADER, buf, len < size ? len : size);
+  atomic_store_explicit(&ring->tail, tail + RING_HEADER + len,
+                        memory_order_release);
+  return len;
+}
+
+ssize_t ring_wait_pop(struct Ring *ring, void *buf, size_t size) {
+  for (;;) {
+    for (int i = 0; i < RING_SPIN; i++) {
+      ssize_t len = ring_pop(ring, buf, size);
+      if (len >= 0) {
+        return len;
+      }
+      if (atomic_load(&ring->closed)) {
+        return 0;
+      }
+    }
+
+    // a push after this load changes seq, so the wait returns at once
+    unsigned int seq = atomic_load(&ring->seq);
+    atomic_store(&ring->sleeping, 1);
+    if (atomic_load(&ring->head) == atomic_load(&ring->tail) &&
+        !atomic_load(&ring->closed)) {
+      futex_wait(&ring->seq, seq);
+    }
+    atomic_store(&ring->sleeping, 0);
+  }
+}
+
+void ring_close(struct Ring *ring) {
+  atomic_store(&ring->closed, 1);
+  atomic_fetch_add(&ring->seq, 1);
+  futex_wake(&ring->seq);
+}
@@ -0,0 +1,86 @@
+#ifndef COMMON_RING_H
+#define COMMON_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Single-producer/single-consumer ring of messages in memory shared by the
+// client and the server. Each message is stored as a 2-byte length followed
+// by its bytes. A consumer that finds the ring empty spins for a while and
+// then sleeps on a futex; the producer only makes the wake-up syscall when
+// the consumer is asleep. A producer that finds the ring full waits in the
+// same way for the consumer to make room.
+
+#define RING_SIZE 65536 // bytes of messages, a power of two
+#define RING_MAX_MESSAGE (RING_SIZE / 2)
+#define RING_SPIN 2000 // empty checks before a consumer goes to sleep
+
+struct Ring {
+  _Alignas(64) atomic_uint head; // bytes ever pushed, moved by the producer
+  _Alignas(64) atomic_uint tail; // bytes ever popped, moved by the consumer
+  _Alignas(64) atomic_uint seq;  // bumped on every push, the futex word
+  atomic_uint sleeping;          // the consumer is idle and wants a wake-up
+  atomic_uint waiting;           // the producer wants to know of free room
+  atomic_uint closed;            // no more messages will be pushed
+  char data[RING_SIZE];
+};
+
+/// Rings of a shared-memory session.
+struct ShmChannel {
+  struct Ring req;   // client to server
+  struct Ring resp;  // server to client
+  struct Ring notif; // server to client
+};
+
+/// Initializes a ring in zeroed memory.
+/// @param ring The ring.
+void ring_init(struct Ring *ring);
+
+/// Adds a message to a ring. Only the producer may call this.
+/// @param ring The ring.
+/// @param msg The message.
+/// @param len Length of the message, at most RING_MAX_MESSAGE.
+/// @return 0 if the message was added, 1 if it does not fit.
+int ring_push(struct Ring *ring, const void *msg, size_t len);
+
+/// Tells whether a message fits in a ring. When it does not, the consumer is
+/// asked to report the room it makes, see ring_made_room. Only the producer
+/// may call this.
+/// @param ring The ring.
+/// @param len Length of the message.
+/// @return 1 if the message fits, 0 if the producer must wait for room.
+int ring_has_room(struct Ring *ring, size_t len);
+
+/// Tells whether the producer of a ring waits for the room made by the
+/// messages just popped. Only the consumer may call this.
+/// @param ring The ring.
+/// @return 1 if the producer waits and must be woken up, 0 otherwise.
+int ring_made_room(struct Ring *ring);
+
+/// Wakes the consumer of a ring up after one or more pushes.
+/// @param ring The ring.
+/// @return 1 if the consumer was idle, 0 otherwise.
+int ring_notify(struct Ring *ring);
+
+/// Takes the oldest message of a ring without waiting. Only the consumer
+/// may call this.
+/// @param ring The ring.
+/// @param buf Where to copy the message.
+/// @param size Size of buf; longer messages are truncated.
+/// @return Length of the message, -1 if the ring is empty.
+ssize_t ring_pop(struct Ring *ring, void *buf, size_t size);
+
+/// Takes the oldest message of a ring, waiting for one if it is empty.
+/// @param ring The ring.
+/// @param buf Where to copy the message.
+/// @param size Size of buf; longer messages are truncated.
+/// @return Length of the message, 0 once the ring is closed and empty.
+ssize_t ring_wait_pop(struct Ring *ring, void *buf, size_t size);
+
+/// Marks a ring closed and wakes its consumer.
+/// @param ring The ring.
+void ring_close(struct Ring *ring);
+
+#endif // COMMON_RING_H
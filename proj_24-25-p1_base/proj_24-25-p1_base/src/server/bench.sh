@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Runs kvs over generated workloads for every combination of max_threads and
+# max_backups, and prints the wall time and key operations per second.
+#
+# Environment:
+#   THREADS    max_threads values to try (default "1 2 4 8")
+#   BACKUPS    max_backups values to try (default "1 4")
+#   KVS_FLAGS  extra flags for kvs, e.g. "-u" or "-w 4"
+
+kvs_binary=${KVS:-./kvs}
+workload_binary=${WORKLOAD:-./workload}
+threads=${THREADS:-"1 2 4 8"}
+backups=${BACKUPS:-"1 4"}
+
+# name and workload arguments of each directory
+workloads=(
+    "uniform   -j 16 -c 5000 -k 5000 -z 0"
+    "zipf      -j 16 -c 5000 -k 5000 -z 0.99"
+    "readheavy -j 16 -c 5000 -k 5000 -z 0.99 -m 90,8,2"
+    "batched   -j 16 -c 1000 -k 5000 -z 0.99 -b 64"
+    "waits     -j 16 -c 5000 -k 5000 -z 0.99 -w 200 -t 2"
+    "backups   -j 16 -c 5000 -k 5000 -z 0.99 -B 500"
+)
+
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+printf "%-10s %7s %7s %10s %12s\n" workload threads backups seconds ops/sec
+
+for workload in "${workloads[@]}"; do
+    read -r name args <<< "$workload"
+    jobs_dir="$work_dir/$name"
+
+    # shellcheck disable=SC2086
+    if ! ops=$("$workload_binary" $args "$jobs_dir"); then
+        echo "Failed to generate $name" >&2
+        exit 1
+    fi
+
+    for t in $threads; do
+        for b in $backups; do
+            rm -f "$jobs_dir"/*.out "$jobs_dir"/*.bck
+
+            start=$(date +%s%N)
+            # shellcheck disable=SC2086
+            if ! "$kvs_binary" $KVS_FLAGS "$jobs_dir" "$t" "$b" \
+                "$work_dir/server_pipe" > /dev/null; then
+                echo "kvs failed on $name" >&2
+                exit 1
+            fi
+            end=$(date +%s%N)
+
+            awk -v name="$name" -v t="$t" -v b="$b" -v ops="$ops" \
+                -v ns=$((end - start)) 'BEGIN {
+                    s = ns / 1e9
+                    printf "%-10s %7d %7d %10.3f %12.0f\n", name, t, b, s, ops / s
+                }'
+        done
+    done
+done
@@ -1,4 +1,22 @@
 #define MAX_WRITE_SIZE 256
 #define MAX_STRING_SIZE 40
 #define MAX_JOB_FILE_NAME_SIZE 256
-#define S_VALUE 2
+#define PARSER_BUFFER_SIZE 65536
+#define JOB_WINDOW_SIZE 128
+#define JOB_QUEUED_BUCKETS 256
+#define MUTATION_BATCH_PAIRS 4096
+#define MUTATION_BATCH_BYTES 65536
+#define MUTATION_BATCH_MS 10
+#define OUTPUT_FLUSH_SIZE 65536
+#define BACKUP_BLOCK_SIZE 65536
+#define SESSION_MAX_EVENTS 64
+#define NOTIFY_MAX_FD 65536
+#define SESSION_INPUT_SIZE 32768
+#define SESSION_OUTPUT_LIMIT 65536
+#define HANDSHAKE_TIMEOUT_MS 1000
+#define HANDSHAKE_RETRY_MS 1
+#define SESSION_MAX_DETACHED 64
+#define SESSION_DETACHED_MS 60000
+#define NOTIFY_QUEUE_SIZE 128
+#define NOTIFY_RETAIN_SIZE 16384
+#define NOTIFY_RETRY_MS 1
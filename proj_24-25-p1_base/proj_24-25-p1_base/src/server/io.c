@@ -1,8 +1,16 @@
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "io.h"
+#include "uring.h"
+
+// Buffers handed to a single writev, well below the IOV_MAX of any system
+#define OUTPUT_IOV_MAX 128
+
 void write_str(int fd, const char *str) {
   size_t len = strlen(str);
   const char *ptr = str;
@@ -43,3 +51,128 @@ size_t strn_memcpy(char *dest, const char *src, size_t n) {
   memcpy(dest, src, bytes_to_copy);
   return bytes_to_copy;
 }
+
+void output_str(struct OutputBuffer *out, const char *str) {
+  size_t len = strlen(str);
+
+  if (out->len + len > out->cap) {
+    size_t cap = out->cap == 0 ? 256 : out->cap;
+    while (cap < out->len + len) {
+      cap *= 2;
+    }
+
+    char *data = realloc(out->data, cap);
+    if (data == NULL) {
+      perror("Error growing output buffer");
+      return;
+    }
+    out->data = data;
+    out->cap = cap;
+  }
+
+  memcpy(out->data + out->len, str, len);
+  out->len += len;
+}
+
+void output_flush(struct OutputBuffer *out, int fd) {
+  output_flush_all(&out, 1, fd);
+}
+
+// Queues the writes of several output buffers on the thread's io_uring,
+// which frees their memory once they are written. The buffers are left empty.
+// @param outs The buffers to write.
+// @param count Number of buffers.
+// @param fd The file descriptor to write to.
+// @return Number of buffers queued, from the first.
+static size_t output_queue_all(struct OutputBuffer *const outs[], size_t count,
+                               int fd) {
+  size_t next = 0;
+
+  while (next < count) {
+    struct iovec iov[URING_MAX_IOV];
+    char *owned[URING_MAX_IOV];
+    int iovcnt = 0;
+    size_t last = next;
+
+    for (; last < count && iovcnt < URING_MAX_IOV; last++) {
+      if (outs[last]->len > 0) {
+        iov[iovcnt].iov_base = outs[last]->data;
+        iov[iovcnt].iov_len = outs[last]->len;
+        owned[iovcnt] = outs[last]->data;
+        iovcnt++;
+      }
+    }
+
+    if (iovcnt > 0 &&
+        uring_writev(fd, iov, iovcnt, owned, (size_t)iovcnt) != 0) {
+      break;
+    }
+
+    for (; next < last; next++) {
+      if (outs[next]->len > 0) {
+        outs[next]->data = NULL;
+        outs[next]->len = 0;
+        outs[next]->cap = 0;
+      }
+    }
+  }
+
+  return next;
+}
+
+void output_flush_all(struct OutputBuffer *const outs[], size_t count,
+                      int fd) {
+  struct iovec iov[OUTPUT_IOV_MAX];
+  size_t next = 0;   // first buffer not handed to writev yet
+  size_t offset = 0; // bytes of outs[next] already written
+
+  if (uring_active()) {
+    next = output_queue_all(outs, count, fd);
+    if (next == count) {
+      return;
+    }
+    // the rest is written here, after what was queued
+    uring_sync(fd);
+  }
+
+  while (next < count) {
+    int iovcnt = 0;
+    for (size_t i = next; i < count && iovcnt < OUTPUT_IOV_MAX; i++) {
+      size_t skip = i == next ? offset : 0;
+      if (outs[i]->len > skip) {
+        iov[iovcnt].iov_base = outs[i]->data + skip;
+        iov[iovcnt].iov_len = outs[i]->len - skip;
+        iovcnt++;
+      }
+    }
+    if (iovcnt == 0) {
+      break;
+    }
+
+    ssize_t written = writev(fd, iov, iovcnt);
+    if (written < 0) {
+      perror("Error writing string");
+      break;
+    }
+
+    // skip the buffers that were written completely
+    size_t left = (size_t)written;
+    while (next < count && left >= outs[next]->len - offset) {
+      left -= outs[next]->len - offset;
+      offset = 0;
+      next++;
+    }
+    offset += left;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    outs[i]->len = 0;
+  }
+}
+
+void output_free(struct OutputBuffer *out) {
+  free(out->data);
+  out->data = NULL;
+  out->len = 0;
+  out->cap = 0;
+}
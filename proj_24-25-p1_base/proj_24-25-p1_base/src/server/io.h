@@ -3,6 +3,13 @@
 
 #include <unistd.h>
 
+/// Output of a command kept in memory until it is written to its file.
+struct OutputBuffer {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
 /// Writes a string to the given file descriptor.
 /// @param fd The file descriptor to write to.
 /// @param str The string to write.
@@ -20,4 +27,27 @@ void write_uint(int fd, int value);
 /// @return Number of bytes copied
 size_t strn_memcpy(char *dest, const char *src, size_t n);
 
+/// Appends a string to an output buffer.
+/// @param out The buffer to append to.
+/// @param str The string to append.
+void output_str(struct OutputBuffer *out, const char *str);
+
+/// Writes the contents of an output buffer to a file descriptor and empties
+/// the buffer.
+/// @param out The buffer to write.
+/// @param fd The file descriptor to write to.
+void output_flush(struct OutputBuffer *out, int fd);
+
+/// Writes the contents of several output buffers to a file descriptor, in
+/// order and with as few system calls as possible, and empties them.
+/// @param outs The buffers to write.
+/// @param count Number of buffers.
+/// @param fd The file descriptor to write to.
+void output_flush_all(struct OutputBuffer *const outs[], size_t count,
+                      int fd);
+
+/// Frees the memory held by an output buffer.
+/// @param out The buffer to free.
+void output_free(struct OutputBuffer *out);
+
 #endif // KVS_IO_H
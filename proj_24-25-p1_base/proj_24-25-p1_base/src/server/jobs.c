@@ -0,0 +1,531 @@
+// F_SETLEASE is not part of POSIX
+#define _GNU_SOURCE
+
+#include "jobs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+// Job file queued since the directory is watched.
+struct QueuedFile {
+  struct timespec mtime; // last change of the contents that were queued
+  struct QueuedFile *next;
+  char name[];
+};
+
+// Orders jobs from the largest to the smallest, keeping the directory order
+// between jobs of the same size.
+static int compare_jobs(const void *a, const void *b) {
+  const struct JobFile *job_a = a;
+  const struct JobFile *job_b = b;
+
+  if (job_a->size != job_b->size) {
+    return job_a->size < job_b->size ? 1 : -1;
+  }
+  return job_a->order < job_b->order ? -1 : job_a->order > job_b->order;
+}
+
+// Builds the path of a file of the jobs directory.
+// @param path Set to the path, MAX_JOB_FILE_NAME_SIZE bytes.
+// @return 0 if the path fits, 1 otherwise.
+static int job_path(const char *dir_name, const char *name, char *path) {
+  int len = snprintf(path, MAX_JOB_FILE_NAME_SIZE, "%s/%s", dir_name, name);
+  return len <= 0 || (size_t)len >= MAX_JOB_FILE_NAME_SIZE;
+}
+
+// Reads the status of a file of the jobs directory.
+// @param st Set to the status, zeroed if it can not be read.
+static void job_stat(const char *dir_name, const char *name,
+                     struct stat *st) {
+  char path[MAX_JOB_FILE_NAME_SIZE];
+  if (job_path(dir_name, name, path) != 0 || stat(path, st) != 0) {
+    memset(st, 0, sizeof(*st));
+  }
+}
+
+// Measures the size of a file of the jobs directory.
+// @return The size, 0 if it can not be measured.
+static off_t job_size(const char *dir_name, const char *name) {
+  struct stat st;
+  job_stat(dir_name, name, &st);
+  return st.st_size;
+}
+
+// Tells if a file of the jobs directory is open for writing, in which case
+// its close event queues it once it is whole. A read lease is refused while
+// a file is open for writing; only the owner of a file may take one, so the
+// files of other users are taken as whole.
+static int job_being_written(const char *dir_name, const char *name) {
+  char path[MAX_JOB_FILE_NAME_SIZE];
+  if (job_path(dir_name, name, path) != 0) {
+    return 0;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+
+  int writing = 0;
+  if (fcntl(fd, F_SETLEASE, F_RDLCK) == 0) {
+    fcntl(fd, F_SETLEASE, F_UNLCK);
+  } else {
+    writing = errno == EAGAIN;
+  }
+  close(fd);
+  return writing;
+}
+
+// Records that a file was queued, with the lock held.
+// @param mtime Last change of the contents being queued.
+// @return 1 if the same contents were queued already, 0 otherwise.
+static int job_queued(struct JobQueue *queue, const char *name,
+                      struct timespec mtime) {
+  size_t hash = 5381;
+  for (const char *c = name; *c != '\0'; c++) {
+    hash = hash * 33 + (unsigned char)*c;
+  }
+  struct QueuedFile **bucket = &queue->queued[hash % JOB_QUEUED_BUCKETS];
+
+  for (struct QueuedFile *file = *bucket; file != NULL; file = file->next) {
+    if (strcmp(file->name, name) == 0) {
+      if (file->mtime.tv_sec == mtime.tv_sec &&
+          file->mtime.tv_nsec == mtime.tv_nsec) {
+        return 1;
+      }
+      file->mtime = mtime; // written again since, it runs again
+      return 0;
+    }
+  }
+
+  size_t len = strlen(name);
+  struct QueuedFile *file = malloc(sizeof(struct QueuedFile) + len + 1);
+  // if memory runs out the file is queued, only not guarded from an event
+  if (file != NULL) {
+    file->mtime = mtime;
+    memcpy(file->name, name, len + 1);
+    file->next = *bucket;
+    *bucket = file;
+  }
+  return 0;
+}
+
+int job_queue_scan(struct JobQueue *queue, const char *dir_name,
+                   int (*filter)(const struct dirent *)) {
+  struct dirent **entries;
+  int num_entries = scandir(dir_name, &entries, filter, NULL);
+  if (num_entries < 0) {
+    perror("Failed to scan jobs directory");
+    return 1;
+  }
+
+  queue->dir_name = dir_name;
+  queue->filter = filter;
+  queue->watch_fd = -1;
+  queue->arrived = NULL;
+  queue->arrived_tail = &queue->arrived;
+  memset(queue->queued, 0, sizeof(queue->queued));
+  queue->count = (size_t)num_entries;
+  atomic_init(&queue->next, 0);
+  queue->parked = NULL;
+  atomic_init(&queue->num_parked, 0);
+  queue->parked_cap = 0;
+  atomic_init(&queue->running, 0);
+  queue->jobs = malloc((queue->count + 1) * sizeof(struct JobFile));
+  if (queue->jobs == NULL) {
+    fprintf(stderr, "Failed to allocate memory for jobs\n");
+    for (size_t i = 0; i < queue->count; i++) {
+      free(entries[i]);
+    }
+    free(entries);
+    return 1;
+  }
+
+  for (size_t i = 0; i < queue->count; i++) {
+    // jobs that can not be measured go last, opening them reports the error
+    queue->jobs[i].entry = entries[i];
+    queue->jobs[i].size = job_size(dir_name, entries[i]->d_name);
+    queue->jobs[i].order = i;
+    queue->jobs[i].watched = 0;
+    queue->jobs[i].next = NULL;
+  }
+  free(entries);
+
+  qsort(queue->jobs, queue->count, sizeof(struct JobFile), compare_jobs);
+
+  // wake times are measured with the monotonic clock
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&queue->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&queue->lock, NULL);
+  return 0;
+}
+
+int job_queue_add(struct JobQueue *queue, const char *name) {
+  size_t len = strlen(name);
+  if (len >= sizeof(((struct dirent *)NULL)->d_name)) {
+    return 0; // scandir would not list it either
+  }
+
+  struct JobFile *file = malloc(sizeof(struct JobFile));
+  struct dirent *entry = calloc(1, sizeof(struct dirent));
+  if (file == NULL || entry == NULL) {
+    fprintf(stderr, "Failed to allocate memory for job %s\n", name);
+    free(file);
+    free(entry);
+    return 1;
+  }
+  memcpy(entry->d_name, name, len + 1);
+
+  if (!queue->filter(entry)) {
+    free(file);
+    free(entry);
+    return 0;
+  }
+
+  struct stat st;
+  job_stat(queue->dir_name, name, &st);
+  file->entry = entry;
+  file->size = st.st_size;
+  file->order = 0;
+  file->watched = 1;
+  file->next = NULL;
+
+  pthread_mutex_lock(&queue->lock);
+  if (job_queued(queue, name, st.st_mtim)) {
+    pthread_mutex_unlock(&queue->lock);
+    free(file);
+    free(entry);
+    return 0;
+  }
+  *queue->arrived_tail = file;
+  queue->arrived_tail = &file->next;
+  pthread_cond_signal(&queue->cond);
+  pthread_mutex_unlock(&queue->lock);
+  return 0;
+}
+
+// Tells if a file was found by the scan of the directory.
+static int job_scanned(struct JobQueue *queue, const char *name) {
+  for (size_t i = 0; i < queue->count; i++) {
+    if (strcmp(queue->jobs[i].entry->d_name, name) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Adds the files of an inotify event buffer to a queue.
+static void add_events(struct JobQueue *queue, const char *buf, size_t len) {
+  const char *ptr = buf;
+  while (ptr < buf + len) {
+    const struct inotify_event *event = (const struct inotify_event *)ptr;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+      fprintf(stderr, "Too many new jobs, some were not queued\n");
+    } else if (event->len > 0 &&
+               (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+      job_queue_add(queue, event->name);
+    }
+    ptr += sizeof(struct inotify_event) + event->len;
+  }
+}
+
+// Thread that queues the job files as they arrive to the directory.
+static void *watch_jobs(void *arg) {
+  struct JobQueue *queue = arg;
+  _Alignas(struct inotify_event) char buf[4096];
+
+  for (;;) {
+    ssize_t len = read(queue->watch_fd, buf, sizeof(buf));
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Failed to watch jobs directory");
+      return NULL;
+    }
+    add_events(queue, buf, (size_t)len);
+  }
+}
+
+int job_queue_watch(struct JobQueue *queue) {
+  queue->watch_fd = inotify_init1(IN_CLOEXEC);
+  if (queue->watch_fd < 0) {
+    perror("Failed to watch jobs directory");
+    return 1;
+  }
+
+  if (inotify_add_watch(queue->watch_fd, queue->dir_name,
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+    perror("Failed to watch jobs directory");
+    close(queue->watch_fd);
+    queue->watch_fd = -1;
+    return 1;
+  }
+
+  // scanned files still being written are queued by their close event
+  // instead, and the others are remembered in case they get one too
+  size_t kept = 0;
+  pthread_mutex_lock(&queue->lock);
+  for (size_t i = 0; i < queue->count; i++) {
+    const char *name = queue->jobs[i].entry->d_name;
+    if (job_being_written(queue->dir_name, name)) {
+      free(queue->jobs[i].entry);
+      continue;
+    }
+    struct stat st;
+    job_stat(queue->dir_name, name, &st);
+    job_queued(queue, name, st.st_mtim);
+    queue->jobs[kept++] = queue->jobs[i];
+  }
+  queue->count = kept;
+  pthread_mutex_unlock(&queue->lock);
+
+  // files written between the scan and the watch got no event
+  struct dirent **entries;
+  int num_entries = scandir(queue->dir_name, &entries, queue->filter, NULL);
+  for (int i = 0; i < num_entries; i++) {
+    if (!job_scanned(queue, entries[i]->d_name) &&
+        !job_being_written(queue->dir_name, entries[i]->d_name)) {
+      job_queue_add(queue, entries[i]->d_name);
+    }
+    free(entries[i]);
+  }
+  if (num_entries >= 0) {
+    free(entries);
+  }
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, watch_jobs, queue) != 0) {
+    fprintf(stderr, "Failed to create watcher thread\n");
+    close(queue->watch_fd);
+    queue->watch_fd = -1;
+    return 1;
+  }
+  pthread_detach(thread);
+  return 0;
+}
+
+struct JobFile *job_queue_pop(struct JobQueue *queue) {
+  size_t index = atomic_fetch_add(&queue->next, 1);
+  return index < queue->count ? &queue->jobs[index] : NULL;
+}
+
+// Tells if a time comes before another.
+static int time_before(struct timespec a, struct timespec b) {
+  return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+// Swaps two parked jobs.
+static void swap_parked(struct Job **parked, size_t i, size_t j) {
+  struct Job *aux = parked[i];
+  parked[i] = parked[j];
+  parked[j] = aux;
+}
+
+// Removes the parked job with the earliest wake time, with the lock held.
+// @param queue The queue, with at least one parked job.
+// @return The job.
+static struct Job *unpark_first(struct JobQueue *queue) {
+  struct Job **parked = queue->parked;
+  struct Job *first = parked[0];
+  size_t count = atomic_load(&queue->num_parked) - 1;
+
+  parked[0] = parked[count];
+  atomic_store(&queue->num_parked, count);
+
+  size_t i = 0;
+  for (;;) {
+    size_t smallest = i;
+    size_t left = 2 * i + 1;
+    size_t right = left + 1;
+
+    if (left < count && time_before(parked[left]->wake, parked[smallest]->wake)) {
+      smallest = left;
+    }
+    if (right < count &&
+        time_before(parked[right]->wake, parked[smallest]->wake)) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      break;
+    }
+    swap_parked(parked, i, smallest);
+    i = smallest;
+  }
+
+  return first;
+}
+
+// Creates the state of a job that has not started yet.
+// @param queue The queue.
+// @param file The job file.
+// @return The job, NULL on failure.
+static struct Job *new_job(struct JobQueue *queue, struct JobFile *file) {
+  struct Job *job = calloc(1, sizeof(struct Job));
+  if (job == NULL) {
+    fprintf(stderr, "Failed to allocate memory for job %s\n",
+            file->entry->d_name);
+    return NULL;
+  }
+
+  job->file = file;
+  job->in_fd = -1;
+  job->out_fd = -1;
+  atomic_fetch_add(&queue->running, 1);
+  return job;
+}
+
+// Removes the oldest file that arrived after the scan, with the lock held.
+// @return The file, NULL if there is none.
+static struct JobFile *take_arrived(struct JobQueue *queue) {
+  struct JobFile *file = queue->arrived;
+  if (file != NULL) {
+    queue->arrived = file->next;
+    if (queue->arrived == NULL) {
+      queue->arrived_tail = &queue->arrived;
+    }
+  }
+  return file;
+}
+
+// Frees a job file if it arrived after the scan.
+static void free_job_file(struct JobFile *file) {
+  if (file->watched) {
+    free(file->entry);
+    free(file);
+  }
+}
+
+struct Job *job_queue_next(struct JobQueue *queue) {
+  struct JobFile *file;
+
+  // no job is waiting, so there is no need for the lock
+  while (atomic_load(&queue->num_parked) == 0 &&
+         (file = job_queue_pop(queue)) != NULL) {
+    struct Job *job = new_job(queue, file);
+    if (job != NULL) {
+      return job;
+    }
+  }
+
+  pthread_mutex_lock(&queue->lock);
+  for (;;) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    size_t num_parked = atomic_load(&queue->num_parked);
+    if (num_parked > 0 && !time_before(now, queue->parked[0]->wake)) {
+      struct Job *job = unpark_first(queue);
+      pthread_mutex_unlock(&queue->lock);
+      return job;
+    }
+
+    if ((file = job_queue_pop(queue)) != NULL ||
+        (file = take_arrived(queue)) != NULL) {
+      struct Job *job = new_job(queue, file);
+      if (job != NULL) {
+        pthread_mutex_unlock(&queue->lock);
+        return job;
+      }
+      free_job_file(file);
+      continue;
+    }
+
+    if (num_parked == 0 && atomic_load(&queue->running) == 0 &&
+        queue->watch_fd < 0) {
+      pthread_mutex_unlock(&queue->lock);
+      return NULL;
+    }
+
+    if (num_parked > 0) {
+      pthread_cond_timedwait(&queue->cond, &queue->lock,
+                             &queue->parked[0]->wake);
+    } else {
+      pthread_cond_wait(&queue->cond, &queue->lock);
+    }
+  }
+}
+
+int job_queue_park(struct JobQueue *queue, struct Job *job,
+                   unsigned int delay_ms) {
+  clock_gettime(CLOCK_MONOTONIC, &job->wake);
+  job->wake.tv_sec += delay_ms / 1000;
+  job->wake.tv_nsec += (long)(delay_ms % 1000) * 1000000;
+  if (job->wake.tv_nsec >= 1000000000) {
+    job->wake.tv_sec++;
+    job->wake.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&queue->lock);
+
+  size_t count = atomic_load(&queue->num_parked);
+  if (count == queue->parked_cap) {
+    size_t cap = queue->parked_cap == 0 ? 16 : 2 * queue->parked_cap;
+    struct Job **parked = realloc(queue->parked, cap * sizeof(struct Job *));
+    if (parked == NULL) {
+      pthread_mutex_unlock(&queue->lock);
+      return 1;
+    }
+    queue->parked = parked;
+    queue->parked_cap = cap;
+  }
+
+  size_t i = count;
+  queue->parked[i] = job;
+  while (i > 0 &&
+         time_before(queue->parked[i]->wake, queue->parked[(i - 1) / 2]->wake)) {
+    swap_parked(queue->parked, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+  atomic_store(&queue->num_parked, count + 1);
+
+  // the earliest wake time may have changed
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->lock);
+  return 0;
+}
+
+void job_queue_finish(struct JobQueue *queue, struct Job *job) {
+  free_job_file(job->file);
+  free(job);
+
+  pthread_mutex_lock(&queue->lock);
+  if (atomic_fetch_sub(&queue->running, 1) == 1) {
+    pthread_cond_broadcast(&queue->cond);
+  }
+  pthread_mutex_unlock(&queue->lock);
+}
+
+void job_queue_free(struct JobQueue *queue) {
+  for (size_t i = 0; i < queue->count; i++) {
+    free(queue->jobs[i].entry);
+  }
+  free(queue->jobs);
+  free(queue->parked);
+  while (queue->arrived != NULL) {
+    free_job_file(take_arrived(queue));
+  }
+  for (size_t i = 0; i < JOB_QUEUED_BUCKETS; i++) {
+    while (queue->queued[i] != NULL) {
+      struct QueuedFile *file = queue->queued[i];
+      queue->queued[i] = file->next;
+      free(file);
+    }
+  }
+  queue->jobs = NULL;
+  queue->parked = NULL;
+  queue->count = 0;
+  pthread_cond_destroy(&queue->cond);
+  pthread_mutex_destroy(&queue->lock);
+}
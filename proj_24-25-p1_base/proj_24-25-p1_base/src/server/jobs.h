@@ -0,0 +1,121 @@
+#ifndef KVS_JOBS_H
+#define KVS_JOBS_H
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "constants.h"
+#include "io.h"
+#include "operations.h"
+#include "window.h"
+
+/// Job file found in the jobs directory.
+struct JobFile {
+  struct dirent *entry;
+  off_t size;   // size of the file when the directory was scanned
+  size_t order; // position in the directory listing
+  int watched;  // arrived after the scan, freed when its job finishes
+  struct JobFile *next; // next file that arrived after it
+};
+
+struct QueuedFile;
+
+/// State of a job that has started running. A job that reaches a WAIT is
+/// parked with it until the wait is over, and then resumed by any thread.
+struct Job {
+  struct JobFile *file;
+  int in_fd; // -1 until the job is started
+  int out_fd;
+  size_t backups; // backups made so far
+  struct OutputBuffer out;
+  struct CommandWindow *window;
+  struct MutationBatch *batch;
+  struct timespec wake; // when a parked job may run again
+};
+
+/// Job files of a directory, largest first. Threads take jobs from it
+/// without locking, so the biggest jobs start first and the small ones fill
+/// the gaps at the end. Jobs parked by a WAIT are kept in a heap ordered by
+/// wake time, guarded by lock. When the directory is watched, files that
+/// arrive later are queued in arrival order, also guarded by lock.
+struct JobQueue {
+  const char *dir_name;
+  struct JobFile *jobs;
+  size_t count;
+  atomic_size_t next; // index of the next job to hand out
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;      // signaled when a job is parked or finishes
+  struct Job **parked;      // min heap of parked jobs by wake time
+  atomic_size_t num_parked; // read without the lock to skip it when zero
+  size_t parked_cap;
+  atomic_size_t running; // jobs started and not finished, parked included
+
+  int (*filter)(const struct dirent *);
+  int watch_fd;             // inotify descriptor, -1 if not watching
+  struct JobFile *arrived;  // files that arrived after the scan, oldest first
+  struct JobFile **arrived_tail;
+  // files queued since the watch started, by hash of their name, so that a
+  // file both listed and reported by an event runs once
+  struct QueuedFile *queued[JOB_QUEUED_BUCKETS];
+};
+
+/// Scans a directory and fills a queue with the files it keeps.
+/// @param queue Queue to fill.
+/// @param dir_name Path of the directory.
+/// @param filter Returns nonzero for the entries that are jobs.
+/// @return 0 if the directory was scanned successfully, 1 otherwise.
+int job_queue_scan(struct JobQueue *queue, const char *dir_name,
+                   int (*filter)(const struct dirent *));
+
+/// Keeps feeding a queue with the job files that are written to or moved
+/// into its directory from now on, so the threads taking jobs from it wait
+/// for new files instead of stopping once every job has finished. Files
+/// still open for writing are left out of the queue until they are closed.
+/// @param queue Queue filled by job_queue_scan, before any job is taken.
+/// @return 0 if the directory is being watched, 1 otherwise.
+int job_queue_watch(struct JobQueue *queue);
+
+/// Adds a file of the directory to the end of a queue, if it is a job that
+/// was not queued already with the same contents. Safe to call from several
+/// threads.
+/// @param queue The queue.
+/// @param name Name of the file in the directory.
+/// @return 0 if the file was added or is not a job, 1 on failure.
+int job_queue_add(struct JobQueue *queue, const char *name);
+
+/// Takes the next job file from a queue. Safe to call from several threads.
+/// @param queue The queue.
+/// @return The job file, NULL if there are no files left.
+struct JobFile *job_queue_pop(struct JobQueue *queue);
+
+/// Waits for a job to run: a parked job whose wait is over or, if there is
+/// none, a job that has not started yet (with in_fd set to -1).
+/// @param queue The queue.
+/// @return The job, NULL once every job has finished and the directory is
+/// not watched.
+struct Job *job_queue_next(struct JobQueue *queue);
+
+/// Parks a job for a given amount of time. The job must not be used after it
+/// is parked, since another thread may resume it right away.
+/// @param queue The queue.
+/// @param job The job.
+/// @param delay_ms Delay in milliseconds.
+/// @return 0 if the job was parked, 1 otherwise.
+int job_queue_park(struct JobQueue *queue, struct Job *job,
+                   unsigned int delay_ms);
+
+/// Frees a job that has finished.
+/// @param queue The queue.
+/// @param job The job.
+void job_queue_finish(struct JobQueue *queue, struct Job *job);
+
+/// Frees the jobs of a queue.
+/// @param queue The queue.
+void job_queue_free(struct JobQueue *queue);
+
+#endif // KVS_JOBS_H
@@ -6,6 +6,7 @@
 #include "string.h"
 
 #include "constants.h"
+#include "notify.h"
 
 // Hash function based on key initial.
 // @param key Lowercase alphabetical string.
@@ -22,6 +23,211 @@ int hash(const char *key) {
   return -1; // Invalid index for non-alphabetic or number strings
 }
 
+// Tells if a node holds the given key.
+// @param keyNode The node.
+// @param key The key.
+// @return 1 if it does, 0 otherwise.
+static int key_matches(const KeyNode *keyNode, struct Span key) {
+  return strncmp(keyNode->key, key.start, key.len) == 0 &&
+         keyNode->key[key.len] == '\0';
+}
+
+// Finds the subscription of a client in a subscriber set.
+// @return The subscription, NULL if the client is not in the set.
+static Subscription *find_subscription(const SubscriberSet *set,
+                                       int notif_fd) {
+  for (size_t i = 0; set != NULL && i < set->count; i++) {
+    if (set->items[i]->notif_fd == notif_fd) {
+      return set->items[i];
+    }
+  }
+  return NULL;
+}
+
+// Frees the nodes of the trie left with neither subscribers nor children,
+// from a node up.
+static void prune_prefix(PrefixNode *node) {
+  while (node->parent != NULL && node->subscribers == NULL &&
+         node->children == NULL) {
+    PrefixNode **link = &node->parent->children;
+    while (*link != node) {
+      link = &(*link)->sibling;
+    }
+    *link = node->sibling;
+
+    PrefixNode *parent = node->parent;
+    free(node);
+    node = parent;
+  }
+}
+
+// Subscribes a client to a key or prefix. Only called with the table
+// locked for writing.
+// @param setp Subscriber set of the key or prefix.
+// @param prefix The prefix, NULL for a key.
+// @return 0 if the client was subscribed, 1 if memory ran out, leaving
+// the trie as it was.
+static int add_subscription(HashTable *ht, SubscriberSet **setp,
+                            PrefixNode *prefix, int notif_fd) {
+  Subscription *sub = malloc(sizeof(Subscription));
+  if (sub == NULL) {
+    goto fail;
+  }
+
+  if ((size_t)notif_fd >= ht->num_clients) {
+    size_t num_clients = ht->num_clients > 0 ? ht->num_clients : 16;
+    while (num_clients <= (size_t)notif_fd) {
+      num_clients *= 2;
+    }
+    Subscriber *clients =
+        realloc(ht->clients, num_clients * sizeof(Subscriber));
+    if (clients == NULL) {
+      goto fail;
+    }
+    memset(clients + ht->num_clients, 0,
+           (num_clients - ht->num_clients) * sizeof(Subscriber));
+    // the first subscription of each client links back into the array
+    for (size_t i = 0; i < ht->num_clients; i++) {
+      if (clients[i].subscriptions != NULL) {
+        clients[i].subscriptions->prev = &clients[i].subscriptions;
+      }
+    }
+    ht->clients = clients;
+    ht->num_clients = num_clients;
+  }
+
+  // grown last, so a failure never leaves an empty set behind
+  SubscriberSet *set = *setp;
+  if (set == NULL || set->count == set->capacity) {
+    size_t capacity = set == NULL ? 2 : 2 * set->capacity;
+    set = realloc(set,
+                  sizeof(SubscriberSet) + capacity * sizeof(Subscription *));
+    if (set == NULL) {
+      goto fail;
+    }
+    if (*setp == NULL) {
+      set->count = 0;
+    }
+    set->capacity = capacity;
+    *setp = set;
+  }
+
+  sub->notif_fd = notif_fd;
+  sub->set = setp;
+  sub->prefix = prefix;
+  sub->slot = set->count;
+  set->items[set->count++] = sub;
+
+  Subscriber *client = &ht->clients[notif_fd];
+  sub->next = client->subscriptions;
+  sub->prev = &client->subscriptions;
+  if (sub->next != NULL) {
+    sub->next->prev = &sub->next;
+  }
+  client->subscriptions = sub;
+  return 0;
+
+fail:
+  free(sub);
+  if (prefix != NULL) {
+    prune_prefix(prefix); // it may have been added for this subscription
+  }
+  return 1;
+}
+
+// Finds the node of a prefix in the trie.
+// @param create 1 to add the nodes that are missing.
+// @return The node, NULL if it is missing or memory ran out.
+static PrefixNode *find_prefix(HashTable *ht, const char *prefix, size_t len,
+                               int create) {
+  PrefixNode *node = &ht->prefixes;
+  for (size_t i = 0; i < len && node != NULL; i++) {
+    PrefixNode *child = node->children;
+    while (child != NULL && child->ch != prefix[i]) {
+      child = child->sibling;
+    }
+    if (child == NULL && create) {
+      child = malloc(sizeof(PrefixNode));
+      if (child == NULL) {
+        prune_prefix(node); // the nodes added for nothing
+        return NULL;
+      }
+      child->ch = prefix[i];
+      child->parent = node;
+      child->children = NULL;
+      child->sibling = node->children;
+      child->subscribers = NULL;
+      node->children = child;
+    }
+    node = child;
+  }
+  return node;
+}
+
+// Removes a subscription from its key or prefix and its client. Only called
+// with the table locked for writing.
+static void remove_subscription(Subscription *sub) {
+  SubscriberSet *set = *sub->set;
+  set->items[sub->slot] = set->items[--set->count];
+  set->items[sub->slot]->slot = sub->slot;
+  if (set->count == 0) {
+    free(set);
+    *sub->set = NULL;
+  }
+  if (sub->prefix != NULL) {
+    prune_prefix(sub->prefix);
+  }
+
+  *sub->prev = sub->next;
+  if (sub->next != NULL) {
+    sub->next->prev = sub->prev;
+  }
+  free(sub);
+}
+
+// Queues a notification of a change for a set of subscribers. A client
+// subscribed to the key through several prefixes is notified once.
+// @param value New value, NULL if the key was deleted.
+// @param version Version of the key after the change.
+static void notify_subscribers(HashTable *ht, const SubscriberSet *set,
+                               const char *key, const char *value,
+                               uint64_t version) {
+  for (size_t i = 0; set != NULL && i < set->count; i++) {
+    int notif_fd = set->items[i]->notif_fd;
+    if (ht->clients[notif_fd].notified == version) {
+      continue;
+    }
+    ht->clients[notif_fd].notified = version;
+
+    if (notify_send(notif_fd, key, value, version) != 0) {
+      fprintf(stderr, "Error queueing notification for FD %d\n", notif_fd);
+    } else if (value == NULL) {
+      printf("Notification queued for FD %d: (%s,DELETED)\n", notif_fd,
+             key);
+    }
+  }
+}
+
+// Queues a notification of a change for the subscribers of the key and of
+// each prefix of it, in one walk down the trie.
+static void notify_change(HashTable *ht, KeyNode *keyNode, const char *value) {
+  notify_subscribers(ht, keyNode->subscribers, keyNode->key, value,
+                     keyNode->version);
+
+  const PrefixNode *node = &ht->prefixes;
+  for (const char *c = keyNode->key; node != NULL; c++) {
+    notify_subscribers(ht, node->subscribers, keyNode->key, value,
+                       keyNode->version);
+    if (*c == '\0') {
+      break;
+    }
+    node = node->children;
+    while (node != NULL && node->ch != *c) {
+      node = node->sibling;
+    }
+  }
+}
+
 struct HashTable *create_hash_table() {
   HashTable *ht = malloc(sizeof(HashTable));
   if (!ht)
@@ -30,27 +236,26 @@ struct HashTable *create_hash_table() {
     ht->table[i] = NULL;
   }
   pthread_rwlock_init(&ht->tablelock, NULL);
+  ht->version = 0;
+  ht->clients = NULL;
+  ht->num_clients = 0;
+  memset(&ht->prefixes, 0, sizeof(ht->prefixes));
   return ht;
 }
 
-int write_pair(HashTable *ht, const char *key, const char *value) {
-  int index = hash(key);
-  char buf[85] = "";
+int write_pair(HashTable *ht, struct Span key, struct Span value) {
+  int index = hash(key.start);
   // Search for the key node
   KeyNode *keyNode = ht->table[index];
   KeyNode *previousNode;
 
   while (keyNode != NULL) {
-    if (strcmp(keyNode->key, key) == 0) {
+    if (key_matches(keyNode, key)) {
       // overwrite value
       free(keyNode->value);
-      keyNode->value = strdup(value);
-      for(int i=0; i < S_VALUE; i++){
-        if(keyNode->fd_notif_subscribers[i] != -1){
-          snprintf(buf, sizeof(buf), "(%s,%s)", keyNode->key, keyNode->value);
-          write(keyNode->fd_notif_subscribers[i], buf, sizeof(buf));
-        }
-      }
+      keyNode->value = strndup(value.start, value.len);
+      keyNode->version = ++ht->version;
+      notify_change(ht, keyNode, keyNode->value);
       return 0;
     }
     previousNode = keyNode;
@@ -58,24 +263,25 @@ int write_pair(HashTable *ht, const char *key, const char *value) {
   }
   // Key not found, create a new key node
   keyNode = malloc(sizeof(KeyNode));
-  keyNode->key = strdup(key);       // Allocate memory for the key
-  keyNode->value = strdup(value);   // Allocate memory for the value
-  keyNode->subscriber_count = 0; // No subscribers initially
-  memset(keyNode->fd_notif_subscribers, -1, sizeof(keyNode->fd_notif_subscribers)); // Initialize subscribers to -1
+  keyNode->key = strndup(key.start, key.len);       // Allocate memory for the key
+  keyNode->value = strndup(value.start, value.len); // Allocate memory for the value
+  keyNode->subscribers = NULL; // No subscribers initially
+  keyNode->version = ++ht->version;
   keyNode->next = ht->table[index]; // Link to existing nodes
   ht->table[index] = keyNode; // Place new key node at the start of the list
+  notify_change(ht, keyNode, keyNode->value); // for the matching prefixes
   return 0;
 }
 
-char *read_pair(HashTable *ht, const char *key) {
-  int index = hash(key);
+char *read_pair(HashTable *ht, struct Span key) {
+  int index = hash(key.start);
 
   KeyNode *keyNode = ht->table[index];
   KeyNode *previousNode;
   char *value;
 
   while (keyNode != NULL) {
-    if (strcmp(keyNode->key, key) == 0) {
+    if (key_matches(keyNode, key)) {
       value = strdup(keyNode->value);
       return value; // Return the value if found
     }
@@ -86,16 +292,15 @@ char *read_pair(HashTable *ht, const char *key) {
   return NULL; // Key not found
 }
 
-int delete_pair(HashTable *ht, const char *key) {
-  int index = hash(key);
+int delete_pair(HashTable *ht, struct Span key) {
+  int index = hash(key.start);
 
   // Search for the key node
   KeyNode *keyNode = ht->table[index];
   KeyNode *prevNode = NULL;
-  char buf[85] = "";
 
   while (keyNode != NULL) {
-    if (strcmp(keyNode->key, key) == 0) {
+    if (key_matches(keyNode, key)) {
       // Key found; delete this node
       if (prevNode == NULL) {
         // Node to delete is the first node in the list
@@ -106,17 +311,10 @@ int delete_pair(HashTable *ht, const char *key) {
       }
 
       // Notify all subscribed clients
-      for (int i = 0; i < S_VALUE; i++) {
-        if (keyNode->fd_notif_subscribers[i] != -1) { // Ensure valid FD
-          snprintf(buf, sizeof(buf), "(%s,DELETED)", keyNode->key);
-          ssize_t bytes_written = write(keyNode->fd_notif_subscribers[i], buf, strlen(buf));
-          if (bytes_written < 0) {
-            perror("Error writing to notification pipe");
-          } else {
-            printf("Notification sent to FD %d: %s (%ld bytes)\n",
-                   keyNode->fd_notif_subscribers[i], buf, bytes_written);
-          }
-        }
+      keyNode->version = ++ht->version;
+      notify_change(ht, keyNode, NULL);
+      while (keyNode->subscribers != NULL) {
+        remove_subscription(keyNode->subscribers->items[0]); // the key is gone
       }
 
       // Free the memory allocated for the key and value
@@ -134,6 +332,13 @@ int delete_pair(HashTable *ht, const char *key) {
 
 
 void free_table(HashTable *ht) {
+  // frees the subscriber sets and the trie along with the subscriptions
+  for (size_t i = 0; i < ht->num_clients; i++) {
+    while (ht->clients[i].subscriptions != NULL) {
+      remove_subscription(ht->clients[i].subscriptions);
+    }
+  }
+
   for (int i = 0; i < TABLE_SIZE; i++) {
     KeyNode *keyNode = ht->table[i];
     while (keyNode != NULL) {
@@ -145,10 +350,58 @@ void free_table(HashTable *ht) {
     }
   }
   pthread_rwlock_destroy(&ht->tablelock);
+  free(ht->clients);
   free(ht);
 }
 
+// Subscribes a client to every key with a prefix.
+// @param prefix The prefix, followed by '*'.
+// @return 0 if the client is subscribed, 1 otherwise.
+static int subscribe_prefix(HashTable *ht, const char *prefix, int notif_fd) {
+  pthread_rwlock_wrlock(&ht->tablelock);
+
+  PrefixNode *node = find_prefix(ht, prefix, strlen(prefix) - 1, 1);
+  int result = 0;
+  if (node == NULL) {
+    result = 1;
+  } else if (find_subscription(node->subscribers, notif_fd) != NULL) {
+    // Client is already subscribed
+  } else if (add_subscription(ht, &node->subscribers, node, notif_fd) != 0) {
+    result = 1;
+  } else {
+    printf("Client subscribed to prefix: %s with FD: %d\n", prefix, notif_fd);
+  }
+
+  pthread_rwlock_unlock(&ht->tablelock);
+  return result;
+}
+
+// Removes a subscription made with subscribe_prefix.
+// @return 0 if the client was subscribed, 1 otherwise.
+static int unsubscribe_prefix(HashTable *ht, const char *prefix,
+                              int notif_fd) {
+  pthread_rwlock_wrlock(&ht->tablelock);
+
+  PrefixNode *node = find_prefix(ht, prefix, strlen(prefix) - 1, 0);
+  Subscription *sub =
+      node != NULL ? find_subscription(node->subscribers, notif_fd) : NULL;
+  if (sub != NULL) {
+    remove_subscription(sub);
+  }
+
+  pthread_rwlock_unlock(&ht->tablelock);
+  return sub == NULL;
+}
+
 int subscribe_client(HashTable *ht, const char *key, int notif_fd) {
+    size_t len = strlen(key);
+    if (notif_fd < 0) {
+        return 1;
+    }
+    if (len > 0 && key[len - 1] == '*') {
+        return subscribe_prefix(ht, key, notif_fd);
+    }
+
     int index = hash(key);
     if (index < 0 || index >= TABLE_SIZE) {
         return 1; // Invalid index
@@ -161,17 +414,17 @@ int subscribe_client(HashTable *ht, const char *key, int notif_fd) {
     while (keyNode != NULL) {
         if (strcmp(keyNode->key, key) == 0) {
             // Key found, check if the client is already subscribed
-            for (int i = 0; i < keyNode->subscriber_count; i++) {
-                if (keyNode->fd_notif_subscribers[i] == notif_fd) {
-                    // Client is already subscribed
-                    pthread_rwlock_unlock(&ht->tablelock);
-                    //printf("Client already subscribed to key: %s\n", key);
-                    return 0;
-                }
+            if (find_subscription(keyNode->subscribers, notif_fd) != NULL) {
+                pthread_rwlock_unlock(&ht->tablelock);
+                //printf("Client already subscribed to key: %s\n", key);
+                return 0;
             }
 
-            // Add the client to the list of subscribers
-            keyNode->fd_notif_subscribers[keyNode->subscriber_count++] = notif_fd;
+            // Add the client to the set of subscribers
+            if (add_subscription(ht, &keyNode->subscribers, NULL, notif_fd) != 0) {
+                pthread_rwlock_unlock(&ht->tablelock);
+                return 1;
+            }
             printf("Client subscribed to key: %s with FD: %d\n", key, notif_fd);
             pthread_rwlock_unlock(&ht->tablelock);
             return 0;
@@ -186,6 +439,11 @@ int subscribe_client(HashTable *ht, const char *key, int notif_fd) {
 }
 
 int unsubscribe_client(HashTable *ht, const char *key, int notif_fd) {
+    size_t len = strlen(key);
+    if (len > 0 && key[len - 1] == '*') {
+        return unsubscribe_prefix(ht, key, notif_fd);
+    }
+
     int index = hash(key);
     if (index < 0 || index >= TABLE_SIZE) {
         return 1; // Invalid index
@@ -197,16 +455,13 @@ int unsubscribe_client(HashTable *ht, const char *key, int notif_fd) {
     KeyNode *keyNode = ht->table[index];
     while (keyNode != NULL) {
         if (strcmp(keyNode->key, key) == 0) {
-            // Key found, remove the client from the list
-            for (int i = 0; i < keyNode->subscriber_count; i++) {
-                if (keyNode->fd_notif_subscribers[i] == notif_fd) {
-                    // Remove this subscriber
-                    keyNode->fd_notif_subscribers[i] = keyNode->fd_notif_subscribers[keyNode->subscriber_count - 1];
-                    keyNode->subscriber_count--;
-                    //printf("Client unsubscribed from key: %s\n", key);
-                    pthread_rwlock_unlock(&ht->tablelock);
-                    return 0; // Successfully unsubscribed
-                }
+            // Key found, remove the client from the set
+            Subscription *sub = find_subscription(keyNode->subscribers, notif_fd);
+            if (sub != NULL) {
+                remove_subscription(sub);
+                //printf("Client unsubscribed from key: %s\n", key);
+                pthread_rwlock_unlock(&ht->tablelock);
+                return 0; // Successfully unsubscribed
             }
 
             // Client not found in the subscriber list
@@ -222,3 +477,12 @@ int unsubscribe_client(HashTable *ht, const char *key, int notif_fd) {
     return 1;
 }
 
+void unsubscribe_all(HashTable *ht, int notif_fd) {
+  pthread_rwlock_wrlock(&ht->tablelock);
+  // only the subscriptions of the client, not the whole table
+  while (notif_fd >= 0 && (size_t)notif_fd < ht->num_clients &&
+         ht->clients[notif_fd].subscriptions != NULL) {
+    remove_subscription(ht->clients[notif_fd].subscriptions);
+  }
+  pthread_rwlock_unlock(&ht->tablelock);
+}
@@ -4,19 +4,64 @@
 
 #include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "constants.h"
+#include "span.h"
+
+struct SubscriberSet;
+struct PrefixNode;
+
+// Subscription of a client to a key or a prefix. It is both in the
+// subscriber set of the key or prefix and in the list of subscriptions of
+// the client, so removing a client only visits its own subscriptions.
+typedef struct Subscription {
+  int notif_fd;               // what the client registered with notify_add
+  struct SubscriberSet **set; // subscriber set of the key or prefix
+  struct PrefixNode *prefix;  // the prefix, NULL for a key
+  size_t slot;                // position in the subscriber set
+  struct Subscription *next;  // next subscription of the client
+  struct Subscription **prev; // link to this one in the list of the client
+} Subscription;
+
+// Subscribers of a key or prefix, grown as clients subscribe.
+typedef struct SubscriberSet {
+  size_t count;
+  size_t capacity;
+  Subscription *items[];
+} SubscriberSet;
+
+// Node of the trie of prefix subscriptions (SUBSCRIBE [prefix*]), one per
+// character of the prefixes. A change to a key walks the trie along the
+// key once, whatever the number of prefixes.
+typedef struct PrefixNode {
+  char ch;                     // last character of the prefix
+  struct PrefixNode *parent;   // NULL for the empty prefix
+  struct PrefixNode *children; // first of the longer prefixes by a character
+  struct PrefixNode *sibling;  // next child of the parent
+  SubscriberSet *subscribers;  // NULL while the prefix has none
+} PrefixNode;
+
+// Subscriptions of a client.
+typedef struct Subscriber {
+  Subscription *subscriptions;
+  uint64_t notified; // version of the last change the client was sent
+} Subscriber;
 
 typedef struct KeyNode {
   char *key;
   char *value;
-  int fd_notif_subscribers[S_VALUE]; //maybe ver valor
-  int subscriber_count;
+  SubscriberSet *subscribers; // NULL while the key has none
+  uint64_t version; // of the last change to the key
   struct KeyNode *next;
 } KeyNode;
 
 typedef struct HashTable {
   KeyNode *table[TABLE_SIZE];
   pthread_rwlock_t tablelock;
+  uint64_t version; // of the last change to any key, under the write lock
+  Subscriber *clients; // subscriptions of each client, by notif_fd
+  size_t num_clients;  // length of clients
+  PrefixNode prefixes; // root of the trie of prefix subscriptions
 } HashTable;
 
 /// Creates a new KVS hash table.
@@ -30,26 +75,42 @@ int hash(const char *key);
 // @param key The key.
 // @param value The value.
 // @return 0 if successful.
-int write_pair(HashTable *ht, const char *key, const char *value);
+int write_pair(HashTable *ht, struct Span key, struct Span value);
 
 // Reads the value of a given key.
 // @param ht The hash table.
 // @param key The key.
 // return the value if found, NULL otherwise.
-char *read_pair(HashTable *ht, const char *key);
+char *read_pair(HashTable *ht, struct Span key);
 
 /// Deletes a pair from the table.
 /// @param ht Hash table to read from.
 /// @param key Key of the pair to be deleted.
 /// @return 0 if the node was deleted successfully, 1 otherwise.
-int delete_pair(HashTable *ht, const char *key);
+int delete_pair(HashTable *ht, struct Span key);
 
 /// Frees the hashtable.
 /// @param ht Hash table to be deleted.
 void free_table(HashTable *ht);
 
+/// Subscribes a client to a key, or to every key with a prefix if the key
+/// ends in '*', including keys written later.
+/// @param ht The hash table.
+/// @param key The key or the prefix followed by '*'.
+/// @param notif_fd What the client registered with notify_add.
+/// @return 0 if the client is subscribed, 1 otherwise.
 int subscribe_client(HashTable *ht, const char *key, int notif_fd);
 
+/// Removes a subscription made with subscribe_client.
+/// @param ht The hash table.
+/// @param key The key or the prefix followed by '*'.
+/// @param notif_fd What the client registered with notify_add.
+/// @return 0 if the client was subscribed, 1 otherwise.
 int unsubscribe_client(HashTable *ht, const char *key, int notif_fd);
 
+/// Removes every subscription of a client.
+/// @param ht The hash table.
+/// @param notif_fd What the client subscribed with.
+void unsubscribe_all(HashTable *ht, int notif_fd);
+
 #endif // KVS_H
@@ -8,9 +8,9 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <semaphore.h>
 #include <errno.h>
 #include <signal.h>
+#include <poll.h>
 
 #include "../common/constants.h"
 #include "../common/protocol.h"
@@ -20,41 +20,20 @@
 #include "operations.h"
 #include "parser.h"
 #include "pthread.h"
+#include "jobs.h"
 #include "kvs.h"
-
-struct SharedData {
-  DIR *dir;
-  char *dir_name;
-  pthread_mutex_t directory_mutex;
-};
-
+#include "notify.h"
+#include "session.h"
+#include "uring.h"
+#include "window.h"
 
 struct HostThreadData {
   char const* host_pipe_path;
   int host_pipe_fd;
+  int host_socket_fd; // -1 when clients only connect through the pipe
 };
 
-typedef struct Client {
-    int req_pipe;         // File descriptor for request pipe
-    int resp_pipe;        // File descriptor for response pipe
-    int notif_pipe;       // File descriptor for notification pipe
-    int id;               // Unique client identifier (for debugging only)
-    pthread_t thread;   // Thread handling the client
-} Client;
-
-Client clients_buf[S_VALUE];    // Array to store client information
-Client *thread_clients[S_VALUE]; // Array of currently executing clients, per thread
-
-int total_client_count = 0;           // Number of total clients
-
-int client_cons_idx;
-int client_prod_idx;
-sem_t client_cons_sem;
-sem_t client_prod_sem;
-
-int signal_usr1_flag = 0;
-
-pthread_mutex_t client_mutex = PTHREAD_MUTEX_INITIALIZER;  // Mutex to protect client list
+volatile sig_atomic_t signal_usr1_flag = 0;
 
 pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t n_current_backups_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -62,7 +41,11 @@ pthread_mutex_t n_current_backups_lock = PTHREAD_MUTEX_INITIALIZER;
 size_t active_backups = 0; // Number of active backups
 size_t max_backups;        // Maximum allowed simultaneous backups
 size_t max_threads;        // Maximum allowed simultaneous threads
+size_t job_workers = 0;    // Threads running the commands of all jobs
+struct WindowPool *window_pool = NULL; // shared by the windows of all jobs
 char *jobs_directory = NULL;
+char *socket_path = NULL;  // Unix socket clients may connect to, if any
+enum NotifyPolicy notify_policy = NOTIFY_DROP_OLDEST; // for slow subscribers
 
 int filter_job_files(const struct dirent *entry) {
   const char *dot = strrchr(entry->d_name, '.');
@@ -95,14 +78,107 @@ static int entry_files(const char *dir, struct dirent *entry, char *in_path,
   return 0;
 }
 
-static int run_job(int in_fd, int out_fd, char *filename) {
-  size_t file_backups = 0;
+enum JobStatus {
+  JOB_DONE,   // the job reached the end of its file
+  JOB_PARKED, // the job was parked by a WAIT
+  JOB_CHILD   // this is a backup process, which must exit
+};
+
+// Opens the files of a job and prepares the state it runs with.
+// @param job The job, not started yet.
+// @param dir Directory of the job file.
+// @return 0 if the job can run, 1 otherwise.
+static int start_job(struct Job *job, const char *dir) {
+  char in_path[MAX_JOB_FILE_NAME_SIZE], out_path[MAX_JOB_FILE_NAME_SIZE];
+  if (entry_files(dir, job->file->entry, in_path, out_path)) {
+    return 1;
+  }
+
+  job->in_fd = open(in_path, O_RDONLY);
+  if (job->in_fd == -1) {
+    write_str(STDERR_FILENO, "Failed to open input file: ");
+    write_str(STDERR_FILENO, in_path);
+    write_str(STDERR_FILENO, "\n");
+    return 1;
+  }
+
+  job->out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (job->out_fd == -1) {
+    write_str(STDERR_FILENO, "Failed to open output file: ");
+    write_str(STDERR_FILENO, out_path);
+    write_str(STDERR_FILENO, "\n");
+    close(job->in_fd);
+    return 1;
+  }
+
+  if (window_pool != NULL) {
+    job->window = window_create(window_pool, job->out_fd);
+    if (job->window == NULL) {
+      write_str(STDERR_FILENO, "Failed to create job window\n");
+    }
+  }
+
+  if (job->window == NULL) {
+    // consecutive WRITEs and DELETEs share one acquisition of the table lock
+    job->batch = malloc(sizeof(struct MutationBatch));
+    if (job->batch != NULL) {
+      job->batch->num_commands = 0;
+      job->batch->num_pairs = 0;
+      job->batch->num_bytes = 0;
+    }
+  }
+
+  return 0;
+}
+
+// Runs what is left of a job's commands and closes its files.
+// @param job The job.
+static void end_job(struct Job *job) {
+  if (job->window != NULL) {
+    window_destroy(job->window);
+  } else if (job->batch != NULL) {
+    kvs_batch_apply(job->batch, &job->out);
+  }
+  output_flush(&job->out, job->out_fd);
+  free(job->batch);
+  output_free(&job->out);
+
+  parser_release(job->in_fd);
+  uring_sync(job->out_fd);
+  close(job->in_fd);
+  close(job->out_fd);
+}
+
+// Runs the commands of a job until it ends or a WAIT parks it.
+// @param queue Queue to park the job in.
+// @param job The job, started.
+// @return Whether the job ended or was parked.
+static enum JobStatus run_job(struct JobQueue *queue, struct Job *job) {
+  int in_fd = job->in_fd;
+  int out_fd = job->out_fd;
+  struct OutputBuffer *out = &job->out;
+  struct CommandWindow *window = job->window;
+  struct MutationBatch *batch = job->batch;
+
   while (1) {
-    char keys[MAX_WRITE_SIZE][MAX_STRING_SIZE] = {0};
-    char values[MAX_WRITE_SIZE][MAX_STRING_SIZE] = {0};
+    struct Span keys[MAX_WRITE_SIZE];
+    struct Span values[MAX_WRITE_SIZE];
     unsigned int delay;
     size_t num_pairs;
 
+    if (batch != NULL && kvs_batch_expire(batch, out)) {
+      write_str(STDERR_FILENO, "Failed to apply batched commands\n");
+    }
+
+    // output is kept in memory and written to the .out file in large blocks,
+    // after the batched commands before it
+    if (out->len >= OUTPUT_FLUSH_SIZE) {
+      if (batch != NULL) {
+        kvs_batch_apply(batch, out);
+      }
+      output_flush(out, out_fd);
+    }
+
     switch (get_next(in_fd)) {
     case CMD_WRITE:
       num_pairs =
@@ -112,7 +188,15 @@ static int run_job(int in_fd, int out_fd, char *filename) {
         continue;
       }
 
-      if (kvs_write(num_pairs, keys, values)) {
+      if (window != NULL) {
+        if (window_add(window, CMD_WRITE, num_pairs, keys, values)) {
+          write_str(STDERR_FILENO, "Failed to write pair\n");
+        }
+      } else if (batch != NULL) {
+        if (kvs_batch_write(batch, num_pairs, keys, values, out)) {
+          write_str(STDERR_FILENO, "Failed to write pair\n");
+        }
+      } else if (kvs_write_spans(num_pairs, keys, values)) {
         write_str(STDERR_FILENO, "Failed to write pair\n");
       }
       break;
@@ -126,8 +210,17 @@ static int run_job(int in_fd, int out_fd, char *filename) {
         continue;
       }
 
-      if (kvs_read(num_pairs, keys, out_fd)) {
-        write_str(STDERR_FILENO, "Failed to read pair\n");
+      if (window != NULL) {
+        if (window_add(window, CMD_READ, num_pairs, keys, NULL)) {
+          write_str(STDERR_FILENO, "Failed to read pair\n");
+        }
+      } else {
+        if (batch != NULL) {
+          kvs_batch_apply(batch, out);
+        }
+        if (kvs_read_spans(num_pairs, keys, out)) {
+          write_str(STDERR_FILENO, "Failed to read pair\n");
+        }
       }
       break;
 
@@ -140,13 +233,32 @@ static int run_job(int in_fd, int out_fd, char *filename) {
         continue;
       }
 
-      if (kvs_delete(num_pairs, keys, out_fd)) {
-        write_str(STDERR_FILENO, "Failed to delete pair\n");
+      if (window != NULL) {
+        if (window_add(window, CMD_DELETE, num_pairs, keys, NULL)) {
+          write_str(STDERR_FILENO, "Failed to delete pair\n");
+        }
+      } else if (batch != NULL) {
+        if (kvs_batch_delete(batch, num_pairs, keys, out)) {
+          write_str(STDERR_FILENO, "Failed to delete pair\n");
+        }
+      } else {
+        if (kvs_delete_spans(num_pairs, keys, out)) {
+          write_str(STDERR_FILENO, "Failed to delete pair\n");
+        }
       }
       break;
 
     case CMD_SHOW:
-      kvs_show(out_fd);
+      if (window != NULL) {
+        if (window_add(window, CMD_SHOW, 0, NULL, NULL)) {
+          write_str(STDERR_FILENO, "Failed to show pairs\n");
+        }
+      } else {
+        if (batch != NULL) {
+          kvs_batch_apply(batch, out);
+        }
+        kvs_show(out);
+      }
       break;
 
     case CMD_WAIT:
@@ -155,13 +267,35 @@ static int run_job(int in_fd, int out_fd, char *filename) {
         continue;
       }
 
+      // WAIT and BACKUP see the effects of every earlier command
+      if (window != NULL) {
+        window_run(window);
+      } else if (batch != NULL) {
+        kvs_batch_apply(batch, out);
+      }
+      output_flush(out, out_fd);
+
       if (delay > 0) {
         printf("Waiting %d seconds\n", delay / 1000);
+
+        // the thread runs other jobs while this one waits, and the job may
+        // be resumed by a thread with another ring
+        uring_sync(out_fd);
+        if (parser_release(in_fd) == 0 &&
+            job_queue_park(queue, job, delay) == 0) {
+          return JOB_PARKED;
+        }
         kvs_wait(delay);
       }
       break;
 
     case CMD_BACKUP:
+      if (window != NULL) {
+        window_run(window);
+      } else if (batch != NULL) {
+        kvs_batch_apply(batch, out);
+      }
+
       pthread_mutex_lock(&n_current_backups_lock);
       if (active_backups >= max_backups) {
         wait(NULL);
@@ -169,12 +303,13 @@ static int run_job(int in_fd, int out_fd, char *filename) {
         active_backups++;
       }
       pthread_mutex_unlock(&n_current_backups_lock);
-      int aux = kvs_backup(++file_backups, filename, jobs_directory);
+      int aux = kvs_backup(++job->backups, job->file->entry->d_name,
+                           jobs_directory);
 
       if (aux < 0) {
         write_str(STDERR_FILENO, "Failed to do backup\n");
       } else if (aux == 1) {
-        return 1;
+        return JOB_CHILD;
       }
       break;
 
@@ -200,218 +335,69 @@ static int run_job(int in_fd, int out_fd, char *filename) {
 
     case EOC:
       printf("EOF\n");
-      return 0;
+      return JOB_DONE;
     }
   }
 }
 
-// frees arguments
 static void *get_file(void *arguments) {
-  struct SharedData *thread_data = (struct SharedData *)arguments;
-  DIR *dir = thread_data->dir;
-  char *dir_name = thread_data->dir_name;
-
-  if (pthread_mutex_lock(&thread_data->directory_mutex) != 0) {
-    fprintf(stderr, "Thread failed to lock directory_mutex\n");
-    return NULL;
-  }
+  struct JobQueue *queue = (struct JobQueue *)arguments;
+  struct Job *job;
 
-  struct dirent *entry;
-  char in_path[MAX_JOB_FILE_NAME_SIZE], out_path[MAX_JOB_FILE_NAME_SIZE];
-  while ((entry = readdir(dir)) != NULL) {
-    if (entry_files(dir_name, entry, in_path, out_path)) {
+  while ((job = job_queue_next(queue)) != NULL) {
+    if (job->in_fd == -1 && start_job(job, queue->dir_name)) {
+      job_queue_finish(queue, job);
       continue;
     }
 
-    if (pthread_mutex_unlock(&thread_data->directory_mutex) != 0) {
-      fprintf(stderr, "Thread failed to unlock directory_mutex\n");
-      return NULL;
-    }
-
-    int in_fd = open(in_path, O_RDONLY);
-    if (in_fd == -1) {
-      write_str(STDERR_FILENO, "Failed to open input file: ");
-      write_str(STDERR_FILENO, in_path);
-      write_str(STDERR_FILENO, "\n");
-      pthread_exit(NULL);
-    }
-
-    int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (out_fd == -1) {
-      write_str(STDERR_FILENO, "Failed to open output file: ");
-      write_str(STDERR_FILENO, out_path);
-      write_str(STDERR_FILENO, "\n");
-      pthread_exit(NULL);
-    }
-
-    int out = run_job(in_fd, out_fd, entry->d_name);
-
-    close(in_fd);
-    close(out_fd);
-
-    if (out) {
-      if (closedir(dir) == -1) {
-        fprintf(stderr, "Failed to close directory\n");
-        return 0;
-      }
-
+    switch (run_job(queue, job)) {
+    case JOB_DONE:
+      end_job(job);
+      job_queue_finish(queue, job);
+      break;
+    case JOB_PARKED:
+      break;
+    case JOB_CHILD:
       exit(0);
     }
-
-    if (pthread_mutex_lock(&thread_data->directory_mutex) != 0) {
-      fprintf(stderr, "Thread failed to lock directory_mutex\n");
-      return NULL;
-    }
-  }
-
-  if (pthread_mutex_unlock(&thread_data->directory_mutex) != 0) {
-    fprintf(stderr, "Thread failed to unlock directory_mutex\n");
-    return NULL;
   }
 
+  uring_exit();
   pthread_exit(NULL);
 }
 
-int send_response(struct Client *client, int opcode, char response) {
-  char buf[2];
-  buf[0] = '0' + opcode;
-  buf[1] = response;
-  ssize_t n = write(client->resp_pipe, buf, 2);
-  
-  if (n < 2) {
-    return 1;
-  }
-
-  return 0;
-}
-
-void add_client(int req_pipe, int resp_pipe, int notif_pipe) {
-    sem_wait(&client_prod_sem);
-
-    pthread_mutex_lock(&client_mutex);
-    clients_buf[client_prod_idx].req_pipe = req_pipe;
-    clients_buf[client_prod_idx].resp_pipe = resp_pipe;
-    clients_buf[client_prod_idx].notif_pipe = notif_pipe;
-    clients_buf[client_prod_idx].id = total_client_count++;
-    printf("Client added: %d\n", clients_buf[client_prod_idx].id);
-    client_prod_idx = (client_prod_idx + 1) % S_VALUE;
-    pthread_mutex_unlock(&client_mutex);
-    
-    sem_post(&client_cons_sem);
-}
-
-void close_client(struct Client *client, int thread_id) {
-    close(client->req_pipe);
-    close(client->resp_pipe);
-    close(client->notif_pipe);
-
-    client->req_pipe = -1;
-
-    thread_clients[thread_id] = NULL;
-}
-
-void remove_client(struct Client *client, int thread_id) {
-    pthread_mutex_lock(&client_mutex);
-     // Log client removal
-    printf("Removing client with id %d\n", client->id);
-    
-    kvs_unsubscribe_client(client->notif_pipe);
-
-    if (client->req_pipe == -1) {
-      pthread_mutex_unlock(&client_mutex);
-      return;
-    }
-
-    // Close file descriptors
-    close_client(client, thread_id);
-
-    pthread_mutex_unlock(&client_mutex);
-    sem_post(&client_prod_sem);
+void close_all_signal() {
+  signal_usr1_flag = 1;
+  signal(SIGUSR1, close_all_signal);
 }
-
-static void process_client(struct Client *client) {
-  send_response(client, OP_CODE_CONNECT, '0');
-
-  for (;;) {
-    char req_buf[121];
-    char *sub_buf = req_buf + 1;
-    int n = read(client->req_pipe, req_buf, sizeof(req_buf));
-    int res = -1;
-
+  
+// Skips the payload of a frame that was rejected, as far as it is already
+// in the pipe, so a client that never sends the rest does not hold up the
+// others.
+// @param fd The pipe.
+// @param len Length of the payload.
+static void discard_payload(int fd, size_t len) {
+  char buf[PIPE_BUF];
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+  while (len > 0 && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+    ssize_t n = read(fd, buf, len < sizeof(buf) ? len : sizeof(buf));
     if (n <= 0) {
-      return;
-    }
-
-    int opcode = (int)(req_buf[0] - '0');
-    switch (opcode) {
-      case OP_CODE_DISCONNECT:
-        printf("Closing client\n");
-        send_response(client, OP_CODE_DISCONNECT, '0');
-        return;
-      case OP_CODE_SUBSCRIBE:
-        res = kvs_subscribe(sub_buf, client->notif_pipe);
-        send_response(client, OP_CODE_SUBSCRIBE, '0' + res);
-        break;
-      case OP_CODE_UNSUBSCRIBE:
-        res = kvs_unsubscribe(sub_buf, client->notif_pipe);
-        send_response(client, OP_CODE_UNSUBSCRIBE, '0' + res);
-        break;
-      default:
-        fprintf(stderr, "Error processing request: unknown opcode %d\n", opcode);
-        break;
-    }
-  }
-}
-
-static void get_client(void *arg) {
-  int thread_id = *(int *)arg;
-  free(arg);
-
-  for (;;) {
-    sem_wait(&client_cons_sem);
-
-    pthread_mutex_lock(&client_mutex); 
-    // NOTE: passes by value, so client is a copy of the one in buffer.
-    // this is necessary for a producer-consumer buffer 
-    struct Client client = clients_buf[client_cons_idx];
-    client_cons_idx = (client_cons_idx + 1) % S_VALUE;
-    thread_clients[thread_id] = &client;
-    pthread_mutex_unlock(&client_mutex);
-
-    process_client(&client);
-    remove_client(&client, thread_id);
-  }
-}
-
-void init_clients() {
-  sem_init(&client_cons_sem, 0, 0);
-  sem_init(&client_prod_sem, 0, S_VALUE);
-
-  for (size_t i = 0; i < S_VALUE; i++) {
-    clients_buf[i].req_pipe = -1;
-    clients_buf[i].resp_pipe = -1;
-    clients_buf[i].notif_pipe = -1;
-    
-    int *client_data = (int *)malloc(sizeof(int));
-    *client_data = i;
-
-    if (pthread_create(&clients_buf[i].thread, NULL, (void *)get_client, (void *)client_data) != 0) {
-      fprintf(stderr, "Failed to create thread %zu\n", i);
-      return;
+      break;
     }
+    len -= (size_t)n;
   }
 }
 
-void close_all_signal() {
-  signal_usr1_flag = 1;
-  signal(SIGUSR1, close_all_signal);
-}
-  
 void welcome_clients(void* arg) {
-  int fserv, frep, fresp, fnot;
-  ssize_t n;
+  int fserv;
+  int timeout = -1;
 
-  char buf[121], rep_pipe_path[41] = {0}, resp_pipe_path[41] = {0}, notifications_pipe_path[41] = {0};
+  struct FrameHeader header;
+  char paths[3 * MAX_PIPE_PATH_LENGTH];
+  char rep_pipe_path[MAX_PIPE_PATH_LENGTH + 1] = {0};
+  char resp_pipe_path[MAX_PIPE_PATH_LENGTH + 1] = {0};
+  char notifications_pipe_path[MAX_PIPE_PATH_LENGTH + 1] = {0};
 
   struct HostThreadData *data = (struct HostThreadData *) (arg);
   fserv = data->host_pipe_fd;
@@ -426,62 +412,68 @@ void welcome_clients(void* arg) {
   for (;;) {
     if (signal_usr1_flag) {
       signal_usr1_flag = 0;
-      
-      pthread_mutex_lock(&client_mutex);
-      for (int i = 0; i < S_VALUE; i++) {
-        if (thread_clients[i] == NULL) continue;
-        close_client(thread_clients[i], i);
-      }
-      pthread_mutex_unlock(&client_mutex); 
+      session_close_all();
     }
 
-    int interrupt = 0; 
-    n = read_all(fserv, buf, 121, &interrupt);
-    
-    if (interrupt) {
-      continue;
+    // wake up to retry the clients that have not opened their pipes yet
+    struct pollfd pfds[2] = {{.fd = fserv, .events = POLLIN},
+                             {.fd = data->host_socket_fd, .events = POLLIN}};
+    int ready = poll(pfds, 2, timeout);
+    if (ready < 0 && errno != EINTR) {
+      perror("Failed to wait for clients");
+      break;
     }
 
-    if (n <= 0) break;
-    printf("%s\n", buf);
-
-    if (buf[0] != '1') return;
-    
-    strncpy(rep_pipe_path, buf + 1, 40);
-    rep_pipe_path[40] = '\0';
-
-    strncpy(resp_pipe_path, buf + 41, 40);
-    resp_pipe_path[40] = '\0';
-    
-    strncpy(notifications_pipe_path, buf + 81, 40);
-    notifications_pipe_path[40] = '\0';
-
-    if ((frep = open(rep_pipe_path, O_RDONLY)) < 0) {
-      perror("Error opening the named pipe");
-      exit(1);
-    } else {
-      printf("REP pipe opened: %s\n", rep_pipe_path);
+    if (ready > 0 && (pfds[1].revents & POLLIN)) {
+      session_accept(data->host_socket_fd);
     }
 
-    if ((fresp = open(resp_pipe_path, O_WRONLY)) < 0) {
-      perror("Error opening the named pipe");
-      exit(1);
-    } else{
-      printf("RESP pipe opened: %s\n", resp_pipe_path);
-    }
+    if (ready > 0 && pfds[0].revents != 0) {
+      int interrupt = 0;
+      ssize_t n = read_all(fserv, &header, FRAME_HEADER_SIZE, &interrupt);
+
+      // a client resuming a session sends its resume request after the paths
+      struct ResumeRequest resume;
+      int has_resume = header.length == sizeof(paths) + sizeof(resume);
+      if (n > 0 && (header.opcode != OP_CODE_CONNECT ||
+                    (header.length != sizeof(paths) && !has_resume))) {
+        fprintf(stderr,
+                "Invalid connect request on the server pipe: opcode %d, "
+                "length %u\n",
+                header.opcode, header.length);
+        discard_payload(fserv, header.length);
+        timeout = session_handshake();
+        continue;
+      }
+      if (n > 0) {
+        // the payload follows the header, so a signal does not cut it short
+        n = read_all(fserv, paths, sizeof(paths), NULL);
+      }
+      if (n > 0 && has_resume) {
+        n = read_all(fserv, &resume, sizeof(resume), NULL);
+      }
+
+      if (n <= 0 && !interrupt) break;
+
+      if (n > 0) {
+        strncpy(rep_pipe_path, paths, MAX_PIPE_PATH_LENGTH);
+        strncpy(resp_pipe_path, paths + MAX_PIPE_PATH_LENGTH,
+                MAX_PIPE_PATH_LENGTH);
+        strncpy(notifications_pipe_path, paths + 2 * MAX_PIPE_PATH_LENGTH,
+                MAX_PIPE_PATH_LENGTH);
+        printf("Client registered: %s\n", rep_pipe_path);
 
-    if ((fnot = open(notifications_pipe_path, O_WRONLY)) < 0) {
-      perror("Error opening the named pipe");
-      exit(1);
-    } else{
-      printf("NOT pipe opened: %s\n", notifications_pipe_path);
+        session_connect(rep_pipe_path, resp_pipe_path, notifications_pipe_path,
+                        header.request_id, has_resume ? &resume : NULL);
+      }
     }
 
-    add_client(frep, fresp, fnot);
+    timeout = session_handshake();
   }
 }
 
-static void dispatch_threads(DIR *dir, char const* host_pipe_path) {
+static void dispatch_threads(struct JobQueue *queue,
+                             char const *host_pipe_path) {
   pthread_t *threads = malloc(max_threads * sizeof(pthread_t));
   int fserv;
 
@@ -490,22 +482,21 @@ static void dispatch_threads(DIR *dir, char const* host_pipe_path) {
     return;
   }
 
-  struct SharedData thread_data = {dir, jobs_directory,
-                                   PTHREAD_MUTEX_INITIALIZER};
-
   sigset_t set;
   sigemptyset(&set);
   sigaddset(&set, SIGUSR1);
   sigaddset(&set, SIGPIPE);
   pthread_sigmask(SIG_BLOCK, &set, NULL);
 
-  init_clients();
+  if (session_start(0) || notify_start(0, notify_policy)) {
+    free(threads);
+    return;
+  }
 
   unlink(host_pipe_path);
   if (mkfifo(host_pipe_path, 0666) < 0){
     printf("Path: %s\n", host_pipe_path);
     perror("Error creating named pipe");
-    pthread_mutex_destroy(&thread_data.directory_mutex);
     free(threads);
     return;
   }
@@ -514,7 +505,6 @@ static void dispatch_threads(DIR *dir, char const* host_pipe_path) {
 
   if ((fserv = open(host_pipe_path, O_RDWR)) < 0) {
     perror("Error opening the named pipe");
-    pthread_mutex_destroy(&thread_data.directory_mutex);
     free(threads);
     return;
   }
@@ -524,20 +514,28 @@ static void dispatch_threads(DIR *dir, char const* host_pipe_path) {
   struct HostThreadData data;
   data.host_pipe_path = host_pipe_path;
   data.host_pipe_fd = fserv;
+  data.host_socket_fd = -1;
+
+  if (socket_path != NULL) {
+    if ((data.host_socket_fd = session_listen(socket_path)) < 0) {
+      free(threads);
+      close(fserv);
+      return;
+    }
+    printf("Server listening on socket: %s\n", socket_path);
+  }
   
   pthread_t host_thread;
   if (pthread_create(&host_thread, NULL, (void*)welcome_clients, (void*)(&data)) != 0) {
       fprintf(stderr, "Failed to create welcome thread\n");
-      pthread_mutex_destroy(&thread_data.directory_mutex);
       free(threads); 
       return;
   }
 
   for (size_t i = 0; i < max_threads; i++) {
-    if (pthread_create(&threads[i], NULL, get_file, (void *)&thread_data) !=
+    if (pthread_create(&threads[i], NULL, get_file, (void *)queue) !=
         0) {
       fprintf(stderr, "Failed to create thread %zu\n", i);
-      pthread_mutex_destroy(&thread_data.directory_mutex);
       free(threads);
       return;
     }
@@ -546,28 +544,71 @@ static void dispatch_threads(DIR *dir, char const* host_pipe_path) {
   for (unsigned int i = 0; i < max_threads; i++) {
     if (pthread_join(threads[i], NULL) != 0) {
       fprintf(stderr, "Failed to join thread %u\n", i);
-      pthread_mutex_destroy(&thread_data.directory_mutex);
       free(threads);
       return;
     }
   }
 
-  if (pthread_mutex_destroy(&thread_data.directory_mutex) != 0) {
-    fprintf(stderr, "Failed to destroy directory_mutex\n");
-  }
-
   free(threads);
   close(fserv);
+  if (data.host_socket_fd >= 0) {
+    close(data.host_socket_fd);
+    unlink(socket_path);
+  }
 }
 
 
 int main(int argc, char **argv) {
-  if (argc < 4) {
+  char *program = argv[0];
+  int watch = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "do:s:uw:")) != -1) {
+    char *end;
+    switch (opt) {
+    case 'd':
+      watch = 1;
+      break;
+    case 'o':
+      if (notify_parse_policy(optarg, &notify_policy) != 0) {
+        fprintf(stderr, "Invalid overflow policy: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 's':
+      socket_path = optarg;
+      break;
+    case 'u':
+      uring_enable();
+      break;
+    case 'w':
+      job_workers = strtoul(optarg, &end, 10);
+      if (*end != '\0') {
+        fprintf(stderr, "Invalid job_workers value\n");
+        return 1;
+      }
+      break;
+    default:
+      return 1;
+    }
+  }
+
+  // Keep the positional arguments at argv[1], argv[2], ...
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (argc < 5) {
     write_str(STDERR_FILENO, "Usage: ");
-    write_str(STDERR_FILENO, argv[0]);
+    write_str(STDERR_FILENO, program);
+    write_str(STDERR_FILENO, " [-d] [-o drop|disconnect]");
+    write_str(STDERR_FILENO, " [-s socket] [-u] [-w job_workers]");
     write_str(STDERR_FILENO, " <jobs_dir>");
     write_str(STDERR_FILENO, " <max_threads>");
-    write_str(STDERR_FILENO, " <max_backups> \n");
+    write_str(STDERR_FILENO, " <max_backups>");
+    write_str(STDERR_FILENO, " <server_pipe> \n");
+    write_str(STDERR_FILENO, "  -w: threads shared by all jobs; READs and SHOWs"
+                             " run in parallel, WRITEs and DELETEs one at a"
+                             " time\n");
     return 1;
   }
 
@@ -603,17 +644,28 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  DIR *dir = opendir(argv[1]);
-  if (dir == NULL) {
+  struct JobQueue queue;
+  if (job_queue_scan(&queue, argv[1], filter_job_files)) {
     fprintf(stderr, "Failed to open directory: %s\n", argv[1]);
     return 0;
   }
 
-  dispatch_threads(dir, argv[4]);
+  if (watch && job_queue_watch(&queue)) {
+    job_queue_free(&queue);
+    return 1;
+  }
+
+  if (job_workers > 1) {
+    window_pool = window_pool_create(job_workers);
+    if (window_pool == NULL) {
+      write_str(STDERR_FILENO, "Failed to create job workers\n");
+    }
+  }
 
-  if (closedir(dir) == -1) {
-    fprintf(stderr, "Failed to close directory\n");
-    return 0;
+  dispatch_threads(&queue, argv[4]);
+  job_queue_free(&queue);
+  if (window_pool != NULL) {
+    window_pool_destroy(window_pool);
   }
 
   while (active_backups > 0) {
@@ -0,0 +1,709 @@
+#include "notify.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/constants.h"
+#include "../common/protocol.h"
+#include "constants.h"
+
+// version, then the key and the value each after a byte with its length
+#define NOTIFY_MAX_FRAME (FRAME_HEADER_SIZE + 8 + 2 * (1 + MAX_STRING_SIZE))
+
+_Static_assert(MAX_NOTIFICATION_BATCH <= RING_MAX_MESSAGE,
+               "a batch must fit a ring");
+_Static_assert(NOTIFY_RETAIN_SIZE >= MAX_NOTIFICATION_BATCH,
+               "a batch must fit the retained frames");
+
+// Latest undelivered change of a key.
+struct Notification {
+  char key[MAX_STRING_SIZE + 1];
+  char value[MAX_STRING_SIZE + 1];
+  int deleted;
+  uint64_t version;
+  uint64_t stamp; // changes when replaced, 0 once written
+  struct timespec queued_at; // when the key got behind
+};
+
+// Frames written to a client at once.
+struct Batch {
+  char bytes[MAX_NOTIFICATION_BATCH];
+  size_t len;
+  int replay; // holds retained frames sent again after a resume
+  size_t slots[NOTIFY_QUEUE_SIZE]; // where the notifications were queued
+  uint64_t stamps[NOTIFY_QUEUE_SIZE];
+  struct timespec queued_at[NOTIFY_QUEUE_SIZE];
+  size_t count;
+};
+
+struct Dispatcher;
+
+struct Subscriber {
+  int fd; // what the client is registered and subscribed with
+  struct Dispatcher *dispatcher;
+
+  // the fields below are under dispatcher->lock
+  int out_fd;             // where the notifications go, -1 while detached
+  struct ShmChannel *shm; // NULL unless the client shares memory
+  void (*on_overflow)(void *ctx);
+  void *ctx;
+
+  // one slot per key, circular, the key behind for longest at head
+  struct Notification queue[NOTIFY_QUEUE_SIZE];
+  size_t head;
+  size_t count;
+  uint64_t next_stamp;
+
+  struct Batch batch; // built and not written yet if batch_ready
+  int batch_ready;
+  uint32_t next_seq; // sequence number of the next frame
+
+  // last frames written, oldest first, to send again to a resumed client
+  char retained[NOTIFY_RETAIN_SIZE];
+  size_t retained_len;
+  size_t replay_pos; // retained frames from replay_pos to replay_end are
+  size_t replay_end; // still to be sent again
+
+  int scheduled;           // in the ready or stalled list of the dispatcher
+  int busy;                // the dispatcher is writing to the client
+  int closed;              // being removed by notify_remove
+  int detached;            // the client is gone, and may resume
+  int broken;              // a write failed, nothing is sent until a resume
+  int overflowed;          // dropped by NOTIFY_DISCONNECT
+  struct Subscriber *next; // in the ready or stalled list
+
+  unsigned long delivered;
+  unsigned long coalesced; // replaced by a newer one before being written
+  unsigned long dropped;
+  long max_lag_us; // longest time a notification waited in the queue
+};
+
+// Thread writing out the queues of its subscribers, one batch of a
+// subscriber at a time so none of them waits behind another.
+struct Dispatcher {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work; // a subscriber became ready
+  pthread_cond_t done; // a write ended
+  struct Subscriber *ready;
+  struct Subscriber *ready_tail;
+  struct Subscriber *stalled; // had no room, retried at retry_at
+  struct timespec retry_at;
+};
+
+static struct Dispatcher *dispatchers = NULL;
+static size_t num_dispatchers = 0;
+static atomic_size_t next_dispatcher;
+static enum NotifyPolicy overflow_policy = NOTIFY_DROP_OLDEST;
+
+// Subscribers indexed by the file descriptor they subscribe with.
+static struct Subscriber *_Atomic *subscribers = NULL;
+static size_t subscriber_capacity = 0;
+
+// Tells how many microseconds passed from one time to another.
+static long elapsed_us(const struct timespec *from, const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1000000 +
+         (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+// Finds the subscriber registered with a file descriptor.
+// @return The subscriber, NULL if there is none.
+static struct Subscriber *lookup(int notif_fd) {
+  if (notif_fd < 0 || (size_t)notif_fd >= subscriber_capacity) {
+    return NULL;
+  }
+  return atomic_load(&subscribers[notif_fd]);
+}
+
+// Tells if a subscriber has frames to send.
+static int has_work(const struct Subscriber *sub) {
+  return sub->batch_ready || sub->replay_pos < sub->replay_end ||
+         sub->count > 0;
+}
+
+// Tells the size of the frame at the start of a buffer.
+static size_t frame_size(const char *frame) {
+  struct FrameHeader header;
+  memcpy(&header, frame, FRAME_HEADER_SIZE);
+  return FRAME_HEADER_SIZE + header.length;
+}
+
+// Tells the sequence number of the frame at the start of a buffer.
+static uint32_t frame_seq(const char *frame) {
+  struct FrameHeader header;
+  memcpy(&header, frame, FRAME_HEADER_SIZE);
+  return header.request_id;
+}
+
+// Adds a subscriber to the ready list of its dispatcher.
+static void schedule(struct Dispatcher *dispatcher, struct Subscriber *sub) {
+  sub->scheduled = 1;
+  sub->next = NULL;
+  if (dispatcher->ready_tail != NULL) {
+    dispatcher->ready_tail->next = sub;
+  } else {
+    dispatcher->ready = sub;
+  }
+  dispatcher->ready_tail = sub;
+  pthread_cond_signal(&dispatcher->work);
+}
+
+// Adds a subscriber that had no room to the stalled list of its dispatcher.
+static void stall(struct Dispatcher *dispatcher, struct Subscriber *sub) {
+  if (dispatcher->stalled == NULL) {
+    clock_gettime(CLOCK_MONOTONIC, &dispatcher->retry_at);
+    dispatcher->retry_at.tv_nsec += NOTIFY_RETRY_MS * 1000000L;
+    if (dispatcher->retry_at.tv_nsec >= 1000000000) {
+      dispatcher->retry_at.tv_sec++;
+      dispatcher->retry_at.tv_nsec -= 1000000000;
+    }
+  }
+  sub->scheduled = 1;
+  sub->next = dispatcher->stalled;
+  dispatcher->stalled = sub;
+}
+
+// Moves the stalled subscribers back to the ready list once it is time.
+static void retry_stalled(struct Dispatcher *dispatcher) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (elapsed_us(&dispatcher->retry_at, &now) < 0) {
+    return;
+  }
+
+  struct Subscriber *stalled = dispatcher->stalled;
+  dispatcher->stalled = NULL;
+  while (stalled != NULL) {
+    struct Subscriber *sub = stalled;
+    stalled = sub->next;
+    schedule(dispatcher, sub);
+  }
+}
+
+// Takes a subscriber out of the ready or stalled list it is in.
+static void unschedule(struct Dispatcher *dispatcher, struct Subscriber *sub) {
+  struct Subscriber *prev = NULL;
+  for (struct Subscriber *it = dispatcher->ready; it != NULL; it = it->next) {
+    if (it == sub) {
+      if (prev != NULL) {
+        prev->next = sub->next;
+      } else {
+        dispatcher->ready = sub->next;
+      }
+      if (dispatcher->ready_tail == sub) {
+        dispatcher->ready_tail = prev;
+      }
+      sub->scheduled = 0;
+      return;
+    }
+    prev = it;
+  }
+
+  for (struct Subscriber **link = &dispatcher->stalled; *link != NULL;
+       link = &(*link)->next) {
+    if (*link == sub) {
+      *link = sub->next;
+      sub->scheduled = 0;
+      return;
+    }
+  }
+}
+
+// Writes the frame of a notification.
+// @param buf Where to write it, with room for NOTIFY_MAX_FRAME bytes.
+// @param seq Sequence number of the frame.
+// @return Size of the frame.
+static size_t encode_frame(char *buf, const struct Notification *note,
+                           uint32_t seq) {
+  size_t key_len = strlen(note->key);
+  size_t value_len = note->deleted ? 0 : strlen(note->value);
+  size_t len = sizeof(note->version) + 1 + key_len + 1 + value_len;
+  struct FrameHeader header = {.length = (uint32_t)len,
+                               .request_id = seq,
+                               .opcode = OP_CODE_NOTIFY};
+
+  char *pos = buf;
+  memcpy(pos, &header, FRAME_HEADER_SIZE);
+  pos += FRAME_HEADER_SIZE;
+  memcpy(pos, &note->version, sizeof(note->version));
+  pos += sizeof(note->version);
+  *pos++ = (char)key_len;
+  memcpy(pos, note->key, key_len);
+  pos += key_len;
+  *pos++ = note->deleted ? (char)FRAME_MISSING : (char)value_len;
+  memcpy(pos, note->value, value_len);
+  return FRAME_HEADER_SIZE + len;
+}
+
+// Builds the next batch of a subscriber: the retained frames still to be
+// sent again, or the notifications at the head of its queue, as many as fit.
+static void fill_batch(struct Subscriber *sub) {
+  struct Batch *batch = &sub->batch;
+  batch->len = 0;
+  batch->count = 0;
+  batch->replay = sub->replay_pos < sub->replay_end;
+  sub->batch_ready = 1;
+
+  if (batch->replay) {
+    size_t end = sub->replay_pos;
+    while (end < sub->replay_end &&
+           end - sub->replay_pos + frame_size(sub->retained + end) <=
+               MAX_NOTIFICATION_BATCH) {
+      end += frame_size(sub->retained + end);
+    }
+    batch->len = end - sub->replay_pos;
+    memcpy(batch->bytes, sub->retained + sub->replay_pos, batch->len);
+    return;
+  }
+
+  for (size_t i = 0; i < sub->count; i++) {
+    size_t slot = (sub->head + i) % NOTIFY_QUEUE_SIZE;
+    struct Notification *note = &sub->queue[slot];
+    if (batch->len + NOTIFY_MAX_FRAME > MAX_NOTIFICATION_BATCH) {
+      break;
+    }
+
+    batch->len += encode_frame(batch->bytes + batch->len, note,
+                               sub->next_seq++);
+    batch->slots[batch->count] = slot;
+    batch->stamps[batch->count] = note->stamp;
+    batch->queued_at[batch->count] = note->queued_at;
+    batch->count++;
+  }
+}
+
+// Tells if the notification in a slot is in the batch of a subscriber.
+static int in_batch(const struct Subscriber *sub, size_t slot) {
+  if (!sub->batch_ready || sub->batch.replay) {
+    return 0;
+  }
+  for (size_t i = 0; i < sub->batch.count; i++) {
+    if (sub->batch.slots[i] == slot &&
+        sub->batch.stamps[i] == sub->queue[slot].stamp) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Keeps the frames of a written batch for resuming, dropping the oldest
+// ones that no longer fit.
+static void retain(struct Subscriber *sub, const struct Batch *batch) {
+  size_t drop = 0;
+  while (sub->retained_len - drop + batch->len > NOTIFY_RETAIN_SIZE) {
+    drop += frame_size(sub->retained + drop);
+  }
+  memmove(sub->retained, sub->retained + drop, sub->retained_len - drop);
+  sub->retained_len -= drop;
+
+  memcpy(sub->retained + sub->retained_len, batch->bytes, batch->len);
+  sub->retained_len += batch->len;
+}
+
+// Takes the notifications of a written batch out of a queue, unless they
+// were replaced by newer ones meanwhile, and accounts for them.
+static void remove_written(struct Subscriber *sub, const struct Batch *batch) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (size_t i = 0; i < batch->count; i++) {
+    long lag = elapsed_us(&batch->queued_at[i], &now);
+    if (lag > sub->max_lag_us) {
+      sub->max_lag_us = lag;
+    }
+
+    struct Notification *note = &sub->queue[batch->slots[i]];
+    if (note->stamp == batch->stamps[i]) {
+      note->stamp = 0;
+    }
+  }
+  sub->delivered += batch->count;
+
+  while (sub->count > 0 && sub->queue[sub->head].stamp == 0) {
+    sub->head = (sub->head + 1) % NOTIFY_QUEUE_SIZE;
+    sub->count--;
+  }
+
+  // keys replaced while being written stay, closing the gaps after them
+  size_t kept = 0;
+  for (size_t i = 0; i < sub->count; i++) {
+    struct Notification *note =
+        &sub->queue[(sub->head + i) % NOTIFY_QUEUE_SIZE];
+    if (note->stamp != 0) {
+      if (kept != i) {
+        sub->queue[(sub->head + kept) % NOTIFY_QUEUE_SIZE] = *note;
+      }
+      kept++;
+    }
+  }
+  sub->count = kept;
+}
+
+// Moves on from the batch of a subscriber once it was written.
+static void finish_batch(struct Subscriber *sub) {
+  if (sub->batch.replay) {
+    sub->replay_pos += sub->batch.len;
+  } else {
+    retain(sub, &sub->batch);
+    remove_written(sub, &sub->batch);
+  }
+  sub->batch_ready = 0;
+}
+
+// Writes the batch of a subscriber to its client without waiting.
+// @return 0 if it was written, 1 if the client has no room for it, -1 if it
+// cannot be delivered.
+static int deliver(struct Subscriber *sub) {
+  const struct Batch *batch = &sub->batch;
+  if (sub->shm != NULL) {
+    if (ring_push(&sub->shm->notif, batch->bytes, batch->len) != 0) {
+      return 1;
+    }
+    ring_notify(&sub->shm->notif);
+    return 0;
+  }
+
+  // a batch fits PIPE_BUF, so a pipe takes all of it or nothing
+  if (write(sub->out_fd, batch->bytes, batch->len) < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 1 : -1;
+  }
+  return 0;
+}
+
+static void *run_dispatcher(void *arg) {
+  struct Dispatcher *dispatcher = arg;
+
+  pthread_mutex_lock(&dispatcher->lock);
+  for (;;) {
+    if (dispatcher->stalled != NULL) {
+      retry_stalled(dispatcher);
+    }
+
+    struct Subscriber *sub = dispatcher->ready;
+    if (sub == NULL) {
+      if (dispatcher->stalled != NULL) {
+        pthread_cond_timedwait(&dispatcher->work, &dispatcher->lock,
+                               &dispatcher->retry_at);
+      } else {
+        pthread_cond_wait(&dispatcher->work, &dispatcher->lock);
+      }
+      continue;
+    }
+
+    dispatcher->ready = sub->next;
+    if (dispatcher->ready == NULL) {
+      dispatcher->ready_tail = NULL;
+    }
+    sub->scheduled = 0;
+    if (!has_work(sub)) {
+      continue;
+    }
+
+    if (!sub->batch_ready) {
+      fill_batch(sub);
+    }
+    sub->busy = 1;
+    pthread_mutex_unlock(&dispatcher->lock);
+
+    int res = deliver(sub);
+
+    pthread_mutex_lock(&dispatcher->lock);
+    sub->busy = 0;
+    if (res == 0) {
+      finish_batch(sub);
+    } else if (res < 0) {
+      // the client is gone, and its session will be closed or detached
+      sub->broken = 1;
+    }
+
+    if (sub->closed || sub->detached) {
+      pthread_cond_broadcast(&dispatcher->done);
+      continue;
+    }
+
+    if (has_work(sub) && !sub->broken) {
+      if (res == 1) {
+        stall(dispatcher, sub);
+      } else {
+        schedule(dispatcher, sub);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int notify_start(size_t count, enum NotifyPolicy policy) {
+  if (count == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    count = cores > 0 ? (size_t)cores : 1;
+  }
+  overflow_policy = policy;
+
+  long max_fds = sysconf(_SC_OPEN_MAX);
+  subscriber_capacity = max_fds > 0 && max_fds < NOTIFY_MAX_FD
+                            ? (size_t)max_fds
+                            : NOTIFY_MAX_FD;
+  subscribers = calloc(subscriber_capacity, sizeof(*subscribers));
+  dispatchers = calloc(count, sizeof(struct Dispatcher));
+  if (subscribers == NULL || dispatchers == NULL) {
+    fprintf(stderr, "Failed to allocate memory for notification dispatchers\n");
+    return 1;
+  }
+  atomic_init(&next_dispatcher, 0);
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+  for (size_t i = 0; i < count; i++) {
+    struct Dispatcher *dispatcher = &dispatchers[i];
+    pthread_mutex_init(&dispatcher->lock, NULL);
+    pthread_cond_init(&dispatcher->work, &attr);
+    pthread_cond_init(&dispatcher->done, NULL);
+
+    if (pthread_create(&dispatcher->thread, NULL, run_dispatcher,
+                       dispatcher) != 0) {
+      fprintf(stderr, "Failed to create notification thread %zu\n", i);
+      pthread_condattr_destroy(&attr);
+      return 1;
+    }
+    num_dispatchers = i + 1;
+  }
+
+  pthread_condattr_destroy(&attr);
+  return 0;
+}
+
+int notify_parse_policy(const char *name, enum NotifyPolicy *policy) {
+  if (strcmp(name, "drop") == 0) {
+    *policy = NOTIFY_DROP_OLDEST;
+  } else if (strcmp(name, "disconnect") == 0) {
+    *policy = NOTIFY_DISCONNECT;
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+// Makes the notification pipe or socket of a client non-blocking.
+// @return 0 on success, 1 otherwise.
+static int set_nonblocking(int fd, struct ShmChannel *shm) {
+  if (shm == NULL && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+    perror("Failed to set up notification pipe");
+    return 1;
+  }
+  return 0;
+}
+
+int notify_add(int notif_fd, struct ShmChannel *shm,
+               void (*on_overflow)(void *ctx), void *ctx) {
+  if (notif_fd < 0 || (size_t)notif_fd >= subscriber_capacity ||
+      num_dispatchers == 0) {
+    fprintf(stderr, "Cannot notify FD %d\n", notif_fd);
+    return 1;
+  }
+  if (set_nonblocking(notif_fd, shm) != 0) {
+    return 1;
+  }
+
+  struct Subscriber *sub = calloc(1, sizeof(struct Subscriber));
+  if (sub == NULL) {
+    fprintf(stderr, "Failed to allocate memory for subscriber\n");
+    return 1;
+  }
+
+  sub->fd = notif_fd;
+  sub->out_fd = notif_fd;
+  sub->shm = shm;
+  sub->on_overflow = on_overflow;
+  sub->ctx = ctx;
+  sub->next_seq = 1;
+  sub->dispatcher =
+      &dispatchers[atomic_fetch_add(&next_dispatcher, 1) % num_dispatchers];
+
+  atomic_store(&subscribers[notif_fd], sub);
+  return 0;
+}
+
+void notify_detach(int notif_fd) {
+  struct Subscriber *sub = lookup(notif_fd);
+  if (sub == NULL) {
+    return;
+  }
+
+  struct Dispatcher *dispatcher = sub->dispatcher;
+  pthread_mutex_lock(&dispatcher->lock);
+  sub->detached = 1;
+  while (sub->busy) {
+    pthread_cond_wait(&dispatcher->done, &dispatcher->lock);
+  }
+  if (sub->scheduled) {
+    unschedule(dispatcher, sub);
+  }
+
+  // a batch that did not get through is sent again from the retained frames
+  if (sub->batch_ready && !sub->batch.replay) {
+    finish_batch(sub);
+  }
+  sub->batch_ready = 0;
+  sub->replay_pos = 0;
+  sub->replay_end = 0;
+  sub->out_fd = -1;
+  sub->shm = NULL;
+  sub->broken = 0;
+  // the session it belonged to is freed once this returns
+  sub->on_overflow = NULL;
+  sub->ctx = NULL;
+  pthread_mutex_unlock(&dispatcher->lock);
+}
+
+int notify_resume(int notif_fd, int out_fd, struct ShmChannel *shm,
+                  uint32_t last_seq, void (*on_overflow)(void *ctx),
+                  void *ctx) {
+  struct Subscriber *sub = lookup(notif_fd);
+  if (sub == NULL || set_nonblocking(out_fd, shm) != 0) {
+    return 1;
+  }
+
+  struct Dispatcher *dispatcher = sub->dispatcher;
+  pthread_mutex_lock(&dispatcher->lock);
+
+  // the client must have every frame before the oldest retained one
+  uint32_t oldest =
+      sub->retained_len > 0 ? frame_seq(sub->retained) : sub->next_seq;
+  if (!sub->detached || sub->overflowed || last_seq >= sub->next_seq ||
+      last_seq + 1 < oldest) {
+    pthread_mutex_unlock(&dispatcher->lock);
+    return 1;
+  }
+
+  size_t pos = 0;
+  while (pos < sub->retained_len &&
+         frame_seq(sub->retained + pos) <= last_seq) {
+    pos += frame_size(sub->retained + pos);
+  }
+  sub->replay_pos = pos;
+  sub->replay_end = sub->retained_len;
+
+  sub->out_fd = out_fd;
+  sub->shm = shm;
+  sub->on_overflow = on_overflow;
+  sub->ctx = ctx;
+  sub->detached = 0;
+  if (has_work(sub)) {
+    schedule(dispatcher, sub);
+  }
+  pthread_mutex_unlock(&dispatcher->lock);
+  return 0;
+}
+
+void notify_remove(int notif_fd) {
+  if (notif_fd < 0 || (size_t)notif_fd >= subscriber_capacity) {
+    return;
+  }
+  struct Subscriber *sub = atomic_exchange(&subscribers[notif_fd], NULL);
+  if (sub == NULL) {
+    return;
+  }
+
+  struct Dispatcher *dispatcher = sub->dispatcher;
+  pthread_mutex_lock(&dispatcher->lock);
+  sub->closed = 1;
+  while (sub->busy) {
+    pthread_cond_wait(&dispatcher->done, &dispatcher->lock);
+  }
+  if (sub->scheduled) {
+    unschedule(dispatcher, sub);
+  }
+  pthread_mutex_unlock(&dispatcher->lock);
+
+  printf("Notifications to FD %d: %lu delivered, %lu coalesced, %lu dropped, "
+         "max lag %ld us\n",
+         notif_fd, sub->delivered, sub->coalesced, sub->dropped + sub->count,
+         sub->max_lag_us);
+  free(sub);
+}
+
+int notify_send(int notif_fd, const char *key, const char *value,
+                uint64_t version) {
+  struct Subscriber *sub = lookup(notif_fd);
+  if (sub == NULL) {
+    return 1;
+  }
+
+  struct Dispatcher *dispatcher = sub->dispatcher;
+  struct Notification *note = NULL;
+
+  pthread_mutex_lock(&dispatcher->lock);
+  if (sub->overflowed) {
+    pthread_mutex_unlock(&dispatcher->lock);
+    return 1;
+  }
+
+  // the client only gets the latest change of a key it is behind on
+  for (size_t i = 0; i < sub->count && note == NULL; i++) {
+    struct Notification *queued =
+        &sub->queue[(sub->head + i) % NOTIFY_QUEUE_SIZE];
+    if (strcmp(queued->key, key) == 0) {
+      note = queued;
+      sub->coalesced++;
+    }
+  }
+
+  if (note == NULL && sub->count == NOTIFY_QUEUE_SIZE) {
+    switch (overflow_policy) {
+    case NOTIFY_DROP_OLDEST:
+      // the gap tells the client it missed a change, unless the change is
+      // already being written
+      if (!in_batch(sub, sub->head)) {
+        sub->next_seq++;
+        sub->dropped++;
+      }
+      sub->head = (sub->head + 1) % NOTIFY_QUEUE_SIZE;
+      sub->count--;
+      break;
+    case NOTIFY_DISCONNECT:
+      sub->overflowed = 1;
+      sub->dropped += sub->count + 1;
+      sub->count = 0;
+      // a detached client has no session to drop, and cannot resume
+      // past the notifications it lost
+      if (!sub->detached) {
+        sub->on_overflow(sub->ctx);
+      }
+      pthread_mutex_unlock(&dispatcher->lock);
+      return 1;
+    }
+  }
+
+  if (note == NULL) {
+    note = &sub->queue[(sub->head + sub->count) % NOTIFY_QUEUE_SIZE];
+    sub->count++;
+    strncpy(note->key, key, MAX_STRING_SIZE);
+    note->key[MAX_STRING_SIZE] = '\0';
+    clock_gettime(CLOCK_MONOTONIC, &note->queued_at);
+  }
+
+  note->deleted = value == NULL;
+  if (value != NULL) {
+    strncpy(note->value, value, MAX_STRING_SIZE);
+    note->value[MAX_STRING_SIZE] = '\0';
+  }
+  note->version = version;
+  note->stamp = ++sub->next_stamp;
+
+  if (!sub->scheduled && !sub->busy && !sub->detached && !sub->broken) {
+    schedule(dispatcher, sub);
+  }
+  pthread_mutex_unlock(&dispatcher->lock);
+  return 0;
+}
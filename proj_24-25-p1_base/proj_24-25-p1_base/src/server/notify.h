@@ -0,0 +1,92 @@
+#ifndef KVS_NOTIFY_H
+#define KVS_NOTIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../common/ring.h"
+
+/// Notification delivery. Writers only copy a notification into the bounded
+/// queue of each subscriber, and a few dispatcher threads write the queues
+/// out to the clients without blocking, as many notifications per write as
+/// fit MAX_NOTIFICATION_BATCH. The queue holds one slot per key, so a key
+/// updated again before the client got the last update only sends the
+/// latest one. A client that does not keep up with many keys fills its
+/// queue, and what happens then is up to the overflow policy.
+///
+/// Each notification goes out as an OP_CODE_NOTIFY frame with the next
+/// sequence number of the subscriber (see ../common/protocol.h). The last
+/// NOTIFY_RETAIN_SIZE bytes of frames are kept, so a client that lost its
+/// connection can resume where it left off: its subscriber is detached,
+/// keeps queueing notifications, and sends the frames the client missed
+/// once resumed.
+
+/// What to do with a notification for a new key when the queue is full.
+enum NotifyPolicy {
+  NOTIFY_DROP_OLDEST, // drop the key the client is behind on for longest
+  NOTIFY_DISCONNECT,  // drop the queue and disconnect the client
+};
+
+/// Starts the dispatcher threads.
+/// @param num_dispatchers Number of threads, 0 for one per online core.
+/// @param policy Overflow policy for every subscriber.
+/// @return 0 if the threads were started, 1 otherwise.
+int notify_start(size_t num_dispatchers, enum NotifyPolicy policy);
+
+/// Parses the name of an overflow policy: drop or disconnect.
+/// @param name The name.
+/// @param policy Set to the policy.
+/// @return 0 if the name is valid, 1 otherwise.
+int notify_parse_policy(const char *name, enum NotifyPolicy *policy);
+
+/// Registers a client that can subscribe to keys.
+/// @param notif_fd Notification pipe or socket, made non-blocking, or the
+/// shared-memory segment the client subscribes with.
+/// @param shm Rings of a shared-memory client, NULL otherwise.
+/// @param on_overflow Called, from a thread writing to the KVS, when the
+/// NOTIFY_DISCONNECT policy drops the client.
+/// @param ctx Argument of on_overflow.
+/// @return 0 if the client was registered, 1 otherwise.
+int notify_add(int notif_fd, struct ShmChannel *shm,
+               void (*on_overflow)(void *ctx), void *ctx);
+
+/// Stops writing to a client that lost its connection, keeping its
+/// notifications for notify_resume. Waits for a write in progress, so the
+/// notification pipe or segment can be released once this returns.
+/// @param notif_fd File descriptor the client was registered with, which
+/// stays open, as the subscriptions refer to it.
+void notify_detach(int notif_fd);
+
+/// Resumes a detached client through a new connection. The frames after
+/// last_seq are sent again, as long as they are all retained and the
+/// NOTIFY_DISCONNECT policy dropped none while the client was detached.
+/// @param notif_fd File descriptor the client was registered with.
+/// @param out_fd Notification pipe or socket of the new connection, made
+/// non-blocking, or its shared-memory segment.
+/// @param shm Rings of the new connection, NULL if it has none.
+/// @param last_seq Sequence number of the last frame the client got.
+/// @param on_overflow As in notify_add.
+/// @param ctx Argument of on_overflow.
+/// @return 0 if the client was resumed, 1 if it cannot be.
+int notify_resume(int notif_fd, int out_fd, struct ShmChannel *shm,
+                  uint32_t last_seq, void (*on_overflow)(void *ctx),
+                  void *ctx);
+
+/// Unregisters a client, dropping its queued notifications and printing its
+/// delivery statistics. Waits for a write to the client in progress, so the
+/// notification pipe can be closed once this returns.
+/// @param notif_fd File descriptor the client was registered with.
+void notify_remove(int notif_fd);
+
+/// Queues a notification for a subscriber, replacing the one for the same
+/// key if it was not written yet. Only called with the table locked for
+/// writing.
+/// @param notif_fd File descriptor the subscriber was registered with.
+/// @param key Key that changed.
+/// @param value Its new value, NULL if it was deleted.
+/// @param version Version of the key after the change.
+/// @return 0 if the notification was queued, 1 otherwise.
+int notify_send(int notif_fd, const char *key, const char *value,
+                uint64_t version);
+
+#endif // KVS_NOTIFY_H
@@ -11,6 +11,7 @@
 #include "constants.h"
 #include "io.h"
 #include "kvs.h"
+#include "uring.h"
 
 static struct HashTable *kvs_table = NULL;
 
@@ -42,26 +43,69 @@ int kvs_terminate() {
   return 0;
 }
 
+// Describes an array of NUL terminated strings as spans.
+// @param num_strings Number of strings, at most MAX_WRITE_SIZE.
+// @param strings Array of strings.
+// @param spans Array to store the spans in.
+static void strings_to_spans(size_t num_strings,
+                             char strings[][MAX_STRING_SIZE],
+                             struct Span spans[]) {
+  for (size_t i = 0; i < num_strings; i++) {
+    spans[i] = (struct Span){strings[i], strlen(strings[i])};
+  }
+}
+
 int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE],
               char values[][MAX_STRING_SIZE]) {
-  if (kvs_table == NULL) {
-    fprintf(stderr, "KVS state must be initialized\n");
-    return 1;
-  }
+  struct Span key_spans[MAX_WRITE_SIZE];
+  struct Span value_spans[MAX_WRITE_SIZE];
 
-  pthread_rwlock_wrlock(&kvs_table->tablelock);
+  strings_to_spans(num_pairs, keys, key_spans);
+  strings_to_spans(num_pairs, values, value_spans);
+  return kvs_write_spans(num_pairs, key_spans, value_spans);
+}
 
+// Writes key value pairs, with the table already locked for writing.
+// @param num_pairs Number of pairs being written.
+// @param keys Array of keys.
+// @param values Array of values.
+static void write_locked(size_t num_pairs, const struct Span keys[],
+                         const struct Span values[]) {
   for (size_t i = 0; i < num_pairs; i++) {
     if (write_pair(kvs_table, keys[i], values[i]) != 0) {
-      fprintf(stderr, "Failed to write key pair (%s,%s)\n", keys[i], values[i]);
+      fprintf(stderr, "Failed to write key pair (%.*s,%.*s)\n",
+              (int)keys[i].len, keys[i].start, (int)values[i].len,
+              values[i].start);
     }
   }
+}
+
+int kvs_write_spans(size_t num_pairs, const struct Span keys[],
+                    const struct Span values[]) {
+  if (kvs_table == NULL) {
+    fprintf(stderr, "KVS state must be initialized\n");
+    return 1;
+  }
 
+  pthread_rwlock_wrlock(&kvs_table->tablelock);
+  write_locked(num_pairs, keys, values);
   pthread_rwlock_unlock(&kvs_table->tablelock);
   return 0;
 }
 
 int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fd) {
+  struct Span key_spans[MAX_WRITE_SIZE];
+  struct OutputBuffer out = {0};
+
+  strings_to_spans(num_pairs, keys, key_spans);
+  int result = kvs_read_spans(num_pairs, key_spans, &out);
+  output_flush(&out, fd);
+  output_free(&out);
+  return result;
+}
+
+int kvs_read_spans(size_t num_pairs, const struct Span keys[],
+                   struct OutputBuffer *out) {
   if (kvs_table == NULL) {
     fprintf(stderr, "KVS state must be initialized\n");
     return 1;
@@ -69,53 +113,223 @@ int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fd) {
 
   pthread_rwlock_rdlock(&kvs_table->tablelock);
 
-  write_str(fd, "[");
+  output_str(out, "[");
   for (size_t i = 0; i < num_pairs; i++) {
     char *result = read_pair(kvs_table, keys[i]);
     char aux[MAX_STRING_SIZE];
     if (result == NULL) {
-      snprintf(aux, MAX_STRING_SIZE, "(%s,KVSERROR)", keys[i]);
+      snprintf(aux, MAX_STRING_SIZE, "(%.*s,KVSERROR)", (int)keys[i].len,
+               keys[i].start);
     } else {
-      snprintf(aux, MAX_STRING_SIZE, "(%s,%s)", keys[i], result);
+      snprintf(aux, MAX_STRING_SIZE, "(%.*s,%s)", (int)keys[i].len,
+               keys[i].start, result);
     }
-    write_str(fd, aux);
+    output_str(out, aux);
     free(result);
   }
-  write_str(fd, "]\n");
+  output_str(out, "]\n");
 
   pthread_rwlock_unlock(&kvs_table->tablelock);
   return 0;
 }
 
 int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fd) {
-  if (kvs_table == NULL) {
-    fprintf(stderr, "KVS state must be initialized\n");
-    return 1;
-  }
-
-  pthread_rwlock_wrlock(&kvs_table->tablelock);
+  struct Span key_spans[MAX_WRITE_SIZE];
+  struct OutputBuffer out = {0};
+
+  strings_to_spans(num_pairs, keys, key_spans);
+  int result = kvs_delete_spans(num_pairs, key_spans, &out);
+  output_flush(&out, fd);
+  output_free(&out);
+  return result;
+}
 
+// Deletes keys, with the table already locked for writing.
+// @param num_pairs Number of keys to delete.
+// @param keys Array of keys.
+// @param out Buffer to append the missing keys to.
+static void delete_locked(size_t num_pairs, const struct Span keys[],
+                          struct OutputBuffer *out) {
   int aux = 0;
   for (size_t i = 0; i < num_pairs; i++) {
     if (delete_pair(kvs_table, keys[i]) != 0) {
       if (!aux) {
-        write_str(fd, "[");
+        output_str(out, "[");
         aux = 1;
       }
       char str[MAX_STRING_SIZE];
-      snprintf(str, MAX_STRING_SIZE, "(%s,KVSMISSING)", keys[i]);
-      write_str(fd, str);
+      snprintf(str, MAX_STRING_SIZE, "(%.*s,KVSMISSING)", (int)keys[i].len,
+               keys[i].start);
+      output_str(out, str);
     }
   }
   if (aux) {
-    write_str(fd, "]\n");
+    output_str(out, "]\n");
+  }
+}
+
+int kvs_delete_spans(size_t num_pairs, const struct Span keys[],
+                     struct OutputBuffer *out) {
+  if (kvs_table == NULL) {
+    fprintf(stderr, "KVS state must be initialized\n");
+    return 1;
   }
 
+  pthread_rwlock_wrlock(&kvs_table->tablelock);
+  delete_locked(num_pairs, keys, out);
   pthread_rwlock_unlock(&kvs_table->tablelock);
   return 0;
 }
 
-void kvs_show(int fd) {
+int kvs_get_values(size_t num_pairs, const struct Span keys[],
+                   char *values[]) {
+  if (kvs_table == NULL) {
+    fprintf(stderr, "KVS state must be initialized\n");
+    return 1;
+  }
+
+  pthread_rwlock_rdlock(&kvs_table->tablelock);
+  for (size_t i = 0; i < num_pairs; i++) {
+    values[i] = read_pair(kvs_table, keys[i]);
+  }
+  pthread_rwlock_unlock(&kvs_table->tablelock);
+  return 0;
+}
+
+int kvs_delete_keys(size_t num_pairs, const struct Span keys[],
+                    int missing[]) {
+  if (kvs_table == NULL) {
+    fprintf(stderr, "KVS state must be initialized\n");
+    return 1;
+  }
+
+  pthread_rwlock_wrlock(&kvs_table->tablelock);
+  for (size_t i = 0; i < num_pairs; i++) {
+    missing[i] = delete_pair(kvs_table, keys[i]) != 0;
+  }
+  pthread_rwlock_unlock(&kvs_table->tablelock);
+  return 0;
+}
+
+// Copies a span into the bytes of a batch.
+// @param batch The batch, with room for the span.
+// @param span The span.
+// @return Span pointing to the copy.
+static struct Span batch_copy(struct MutationBatch *batch, struct Span span) {
+  struct Span copy = {batch->bytes + batch->num_bytes, span.len};
+  memcpy(batch->bytes + batch->num_bytes, span.start, span.len);
+  batch->num_bytes += span.len;
+  return copy;
+}
+
+// Tells how many milliseconds passed since a batch got its first command.
+static long batch_age_ms(const struct MutationBatch *batch) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - batch->started.tv_sec) * 1000 +
+         (now.tv_nsec - batch->started.tv_nsec) / 1000000;
+}
+
+int kvs_batch_expire(struct MutationBatch *batch, struct OutputBuffer *out) {
+  if (batch->num_commands == 0 || batch_age_ms(batch) < MUTATION_BATCH_MS) {
+    return 0;
+  }
+  return kvs_batch_apply(batch, out);
+}
+
+// Adds a WRITE or DELETE to a batch, applying the batch when it fills up or
+// gets too old.
+// @param batch The batch.
+// @param is_delete 1 for a DELETE, 0 for a WRITE.
+// @param num_pairs Number of pairs of the command.
+// @param keys Array of keys.
+// @param values Array of values, NULL for a DELETE.
+// @param out Buffer to append the output of applied commands to.
+// @return 0 if successful, 1 otherwise.
+static int batch_add(struct MutationBatch *batch, int is_delete,
+                     size_t num_pairs, const struct Span keys[],
+                     const struct Span values[], struct OutputBuffer *out) {
+  if (kvs_table == NULL) {
+    fprintf(stderr, "KVS state must be initialized\n");
+    return 1;
+  }
+
+  size_t num_bytes = 0;
+  for (size_t i = 0; i < num_pairs; i++) {
+    num_bytes += keys[i].len + (values != NULL ? values[i].len : 0);
+  }
+
+  if (batch->num_pairs + num_pairs > MUTATION_BATCH_PAIRS ||
+      batch->num_bytes + num_bytes > MUTATION_BATCH_BYTES) {
+    kvs_batch_apply(batch, out);
+  }
+
+  if (num_pairs > MUTATION_BATCH_PAIRS || num_bytes > MUTATION_BATCH_BYTES) {
+    // too big for any batch, apply it on its own
+    return is_delete ? kvs_delete_spans(num_pairs, keys, out)
+                     : kvs_write_spans(num_pairs, keys, values);
+  }
+
+  if (batch->num_commands == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &batch->started);
+  }
+
+  struct BatchedCommand *command = &batch->commands[batch->num_commands++];
+  command->is_delete = is_delete;
+  command->first = batch->num_pairs;
+  command->num_pairs = num_pairs;
+
+  for (size_t i = 0; i < num_pairs; i++) {
+    batch->keys[batch->num_pairs] = batch_copy(batch, keys[i]);
+    if (values != NULL) {
+      batch->values[batch->num_pairs] = batch_copy(batch, values[i]);
+    }
+    batch->num_pairs++;
+  }
+
+  return kvs_batch_expire(batch, out);
+}
+
+int kvs_batch_write(struct MutationBatch *batch, size_t num_pairs,
+                    const struct Span keys[], const struct Span values[],
+                    struct OutputBuffer *out) {
+  return batch_add(batch, 0, num_pairs, keys, values, out);
+}
+
+int kvs_batch_delete(struct MutationBatch *batch, size_t num_pairs,
+                     const struct Span keys[], struct OutputBuffer *out) {
+  return batch_add(batch, 1, num_pairs, keys, NULL, out);
+}
+
+int kvs_batch_apply(struct MutationBatch *batch, struct OutputBuffer *out) {
+  if (batch->num_commands == 0) {
+    return 0;
+  }
+
+  if (kvs_table == NULL) {
+    fprintf(stderr, "KVS state must be initialized\n");
+    return 1;
+  }
+
+  pthread_rwlock_wrlock(&kvs_table->tablelock);
+  for (size_t i = 0; i < batch->num_commands; i++) {
+    struct BatchedCommand *command = &batch->commands[i];
+    if (command->is_delete) {
+      delete_locked(command->num_pairs, &batch->keys[command->first], out);
+    } else {
+      write_locked(command->num_pairs, &batch->keys[command->first],
+                   &batch->values[command->first]);
+    }
+  }
+  pthread_rwlock_unlock(&kvs_table->tablelock);
+
+  batch->num_commands = 0;
+  batch->num_pairs = 0;
+  batch->num_bytes = 0;
+  return 0;
+}
+
+void kvs_show(struct OutputBuffer *out) {
   if (kvs_table == NULL) {
     fprintf(stderr, "KVS state must be initialized\n");
     return;
@@ -129,7 +343,7 @@ void kvs_show(int fd) {
     while (keyNode != NULL) {
       snprintf(aux, MAX_STRING_SIZE, "(%s, %s)\n", keyNode->key,
                keyNode->value);
-      write_str(fd, aux);
+      output_str(out, aux);
       keyNode = keyNode->next; // Move to the next node of the list
     }
   }
@@ -137,6 +351,35 @@ void kvs_show(int fd) {
   pthread_rwlock_unlock(&kvs_table->tablelock);
 }
 
+// Blocks a backup is written in, two so that one is filled while the other
+// is written. Only used by backup processes, each with its own copy.
+static char backup_blocks[2][BACKUP_BLOCK_SIZE];
+
+// Writes a block of a backup, through io_uring when it is in use.
+// @param fd File descriptor of the backup file.
+// @param block Index of the block in backup_blocks.
+// @param len Number of bytes of the block to write.
+// @return Index of the block to fill next.
+static size_t write_backup_block(int fd, size_t block, size_t len) {
+  struct iovec iov = {backup_blocks[block], len};
+
+  // a queued write waits for the previous one, so the other block is free
+  if (uring_writev(fd, &iov, 1, NULL, 0) == 0) {
+    return 1 - block;
+  }
+
+  const char *ptr = backup_blocks[block];
+  while (len > 0) {
+    ssize_t written = write(fd, ptr, len);
+    if (written < 0) {
+      break;
+    }
+    ptr += written;
+    len -= (size_t)written;
+  }
+  return block;
+}
+
 int kvs_backup(size_t num_backup, char *job_filename, char *directory) {
   pid_t pid;
   char bck_name[50];
@@ -149,7 +392,10 @@ int kvs_backup(size_t num_backup, char *job_filename, char *directory) {
   if (pid == 0) {
     // functions used here have to be async signal safe, since this
     // fork happens in a multi thread context (see man fork)
+    uring_forget();
     int fd = open(bck_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    size_t block = 0;
+    size_t block_len = 0;
     for (int i = 0; i < TABLE_SIZE; i++) {
       KeyNode *keyNode = kvs_table->table[i]; // Get the next list head
       while (keyNode != NULL) {
@@ -165,11 +411,19 @@ int kvs_backup(size_t num_backup, char *job_filename, char *directory) {
                                         MAX_STRING_SIZE - num_bytes_copied - 1);
         num_bytes_copied += strn_memcpy(aux + num_bytes_copied, ")\n",
                                         MAX_STRING_SIZE - num_bytes_copied - 1);
-        aux[num_bytes_copied] = '\0';
-        write_str(fd, aux);
+        if (block_len + num_bytes_copied > BACKUP_BLOCK_SIZE) {
+          block = write_backup_block(fd, block, block_len);
+          block_len = 0;
+        }
+        memcpy(backup_blocks[block] + block_len, aux, num_bytes_copied);
+        block_len += num_bytes_copied;
         keyNode = keyNode->next; // Move to the next node of the list
       }
     }
+    if (block_len > 0) {
+      write_backup_block(fd, block, block_len);
+    }
+    uring_sync(fd);
     exit(1);
   } else if (pid < 0) {
     return -1;
@@ -191,24 +445,7 @@ int kvs_unsubscribe(char *key, int notif_fd){
 }
 
 int kvs_unsubscribe_client(int notif_fd) {
-  pthread_rwlock_wrlock(&kvs_table->tablelock);
-
-  for (int i = 0; i < TABLE_SIZE; i++) {
-    KeyNode *keyNode = kvs_table->table[i]; // Get the next list head
-    while (keyNode != NULL) {
-      for (int j = 0; j < keyNode->subscriber_count; j++) {
-        if (keyNode->fd_notif_subscribers[j] == notif_fd) {
-          keyNode->fd_notif_subscribers[j] = keyNode->fd_notif_subscribers[keyNode->subscriber_count - 1];
-          keyNode->subscriber_count--;
-          break;
-        }
-      }
-
-      keyNode = keyNode->next; // Move to the next node of the list
-    }
-  }
-
-  pthread_rwlock_unlock(&kvs_table->tablelock);
+  unsubscribe_all(kvs_table, notif_fd);
   return 0;
 }
 
@@ -2,8 +2,32 @@
 #define KVS_OPERATIONS_H
 
 #include <stddef.h>
+#include <time.h>
 
 #include "constants.h"
+#include "io.h"
+#include "span.h"
+
+/// WRITE or DELETE command kept in a MutationBatch.
+struct BatchedCommand {
+  int is_delete;
+  size_t first;     // index of its first pair in the batch
+  size_t num_pairs;
+};
+
+/// Consecutive WRITE and DELETE commands of a job, applied to the KVS under
+/// a single acquisition of the table lock. Keys and values are copied into
+/// the batch, so the commands they came from can be overwritten.
+struct MutationBatch {
+  struct BatchedCommand commands[MUTATION_BATCH_PAIRS];
+  size_t num_commands;
+  struct Span keys[MUTATION_BATCH_PAIRS];
+  struct Span values[MUTATION_BATCH_PAIRS];
+  size_t num_pairs;
+  char bytes[MUTATION_BATCH_BYTES];
+  size_t num_bytes;
+  struct timespec started; // when the first command was added
+};
 
 /// Initializes the KVS state.
 /// @return 0 if the KVS state was initialized successfully, 1 otherwise.
@@ -21,6 +45,14 @@ int kvs_terminate();
 int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE],
               char values[][MAX_STRING_SIZE]);
 
+/// Same as kvs_write, with keys and values given as spans.
+/// @param num_pairs Number of pairs being written.
+/// @param keys Array of keys.
+/// @param values Array of values.
+/// @return 0 if the pairs were written successfully, 1 otherwise.
+int kvs_write_spans(size_t num_pairs, const struct Span keys[],
+                    const struct Span values[]);
+
 /// Reads values from the KVS.
 /// @param num_pairs Number of pairs to read.
 /// @param keys Array of keys' strings.
@@ -28,15 +60,83 @@ int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE],
 /// @return 0 if the key reading, 1 otherwise.
 int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fd);
 
+/// Same as kvs_read, with keys given as spans.
+/// @param num_pairs Number of pairs to read.
+/// @param keys Array of keys.
+/// @param out Buffer to append the (successful) output to.
+/// @return 0 if the key reading, 1 otherwise.
+int kvs_read_spans(size_t num_pairs, const struct Span keys[],
+                   struct OutputBuffer *out);
+
 /// Deletes key value pairs from the KVS.
 /// @param num_pairs Number of pairs to read.
 /// @param keys Array of keys' strings.
 /// @return 0 if the pairs were deleted successfully, 1 otherwise.
 int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fd);
 
+/// Same as kvs_delete, with keys given as spans.
+/// @param num_pairs Number of pairs to read.
+/// @param keys Array of keys.
+/// @param out Buffer to append the output to.
+/// @return 0 if the pairs were deleted successfully, 1 otherwise.
+int kvs_delete_spans(size_t num_pairs, const struct Span keys[],
+                     struct OutputBuffer *out);
+
+/// Reads values from the KVS for a client session.
+/// @param num_pairs Number of keys.
+/// @param keys Array of keys.
+/// @param values Set to copies of the values, NULL for missing keys, which
+/// the caller frees.
+/// @return 0 if the keys were read, 1 otherwise.
+int kvs_get_values(size_t num_pairs, const struct Span keys[],
+                   char *values[]);
+
+/// Deletes keys from the KVS for a client session.
+/// @param num_pairs Number of keys.
+/// @param keys Array of keys.
+/// @param missing Set to 1 for each key that did not exist, 0 otherwise.
+/// @return 0 if the keys were deleted, 1 otherwise.
+int kvs_delete_keys(size_t num_pairs, const struct Span keys[],
+                    int missing[]);
+
+/// Adds a WRITE to a batch. The batch is applied once it holds
+/// MUTATION_BATCH_PAIRS pairs, MUTATION_BATCH_BYTES bytes or commands older
+/// than MUTATION_BATCH_MS milliseconds.
+/// @param batch The batch.
+/// @param num_pairs Number of pairs being written.
+/// @param keys Array of keys.
+/// @param values Array of values.
+/// @param out Buffer to append the output of applied commands to.
+/// @return 0 if the pairs were written or batched successfully, 1 otherwise.
+int kvs_batch_write(struct MutationBatch *batch, size_t num_pairs,
+                    const struct Span keys[], const struct Span values[],
+                    struct OutputBuffer *out);
+
+/// Adds a DELETE to a batch, with the same limits as kvs_batch_write.
+/// @param batch The batch.
+/// @param num_pairs Number of pairs to delete.
+/// @param keys Array of keys.
+/// @param out Buffer to append the output of applied commands to.
+/// @return 0 if the pairs were deleted or batched successfully, 1 otherwise.
+int kvs_batch_delete(struct MutationBatch *batch, size_t num_pairs,
+                     const struct Span keys[], struct OutputBuffer *out);
+
+/// Applies a batch if its first command is older than MUTATION_BATCH_MS
+/// milliseconds, so a batch that stops growing is not held back.
+/// @param batch The batch.
+/// @param out Buffer to append the output of the DELETEs to.
+/// @return 0 if the batch was kept or applied successfully, 1 otherwise.
+int kvs_batch_expire(struct MutationBatch *batch, struct OutputBuffer *out);
+
+/// Applies every command of a batch, in order, and empties it.
+/// @param batch The batch.
+/// @param out Buffer to append the output of the DELETEs to.
+/// @return 0 if the commands were applied successfully, 1 otherwise.
+int kvs_batch_apply(struct MutationBatch *batch, struct OutputBuffer *out);
+
 /// Writes the state of the KVS.
-/// @param fd File descriptor to write the output.
-void kvs_show(int fd);
+/// @param out Buffer to append the output to.
+void kvs_show(struct OutputBuffer *out);
 
 /// Creates a backup of the KVS state and stores it in the correspondent
 /// backup file
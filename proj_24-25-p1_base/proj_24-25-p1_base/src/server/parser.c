@@ -7,6 +7,119 @@
 
 #include "constants.h"
 #include "io.h"
+#include "tokenizer.h"
+#include "uring.h"
+
+// Read buffer for the job file currently being parsed. Each job thread parses
+// a single file at a time, so the buffer is kept per thread and is bound to the
+// descriptor it was last filled from. A job that moves to another thread
+// gives its buffered input back with parser_release.
+struct InputBuffer {
+  int fd;
+  size_t pos;
+  size_t len;
+  char data[PARSER_BUFFER_SIZE];
+};
+
+static _Thread_local struct InputBuffer input = {.fd = -1};
+
+// Storage for the keys and values of a command too long for the input
+// buffer, which is parsed one byte at a time and cannot point into it.
+static _Thread_local char long_keys[MAX_WRITE_SIZE][MAX_STRING_SIZE];
+static _Thread_local char long_values[MAX_WRITE_SIZE][MAX_STRING_SIZE];
+
+// Makes the input buffer hold data from fd, dropping whatever it held from
+// a previous descriptor.
+// @param fd File descriptor about to be read.
+static void bind_input(int fd) {
+  if (input.fd != fd) {
+    input.fd = fd;
+    input.pos = 0;
+    input.len = 0;
+  }
+}
+
+int parser_release(int fd) {
+  off_t unread = (off_t)uring_unread(fd);
+
+  if (input.fd == fd) {
+    unread += (off_t)(input.len - input.pos);
+    input.fd = -1;
+    input.pos = 0;
+    input.len = 0;
+  }
+
+  if (unread > 0 && lseek(fd, -unread, SEEK_CUR) == -1) {
+    return -1;
+  }
+  return 0;
+}
+
+// Reads from a job file, through io_uring when it is in use.
+static ssize_t read_input(int fd, void *dest, size_t count) {
+  return uring_active() ? uring_read(fd, dest, count) : read(fd, dest, count);
+}
+
+// Reads up to count bytes from fd through the thread's input buffer, only
+// issuing a read() when the buffer runs empty.
+// @param fd File descriptor to read from.
+// @param dest Where to copy the bytes to.
+// @param count Number of bytes wanted.
+// @return Number of bytes copied, 0 on end of file, -1 on error.
+static ssize_t buffered_read(int fd, void *dest, size_t count) {
+  bind_input(fd);
+
+  char *out = dest;
+  size_t copied = 0;
+  while (copied < count) {
+    if (input.pos == input.len) {
+      ssize_t bytes_read = read_input(fd, input.data, sizeof(input.data));
+      if (bytes_read <= 0) {
+        // forget the descriptor, it may be reused for another job file
+        input.fd = -1;
+        return copied > 0 ? (ssize_t)copied : bytes_read;
+      }
+      input.pos = 0;
+      input.len = (size_t)bytes_read;
+    }
+
+    size_t chunk = input.len - input.pos;
+    if (chunk > count - copied) {
+      chunk = count - copied;
+    }
+    memcpy(out + copied, input.data + input.pos, chunk);
+    input.pos += chunk;
+    copied += chunk;
+  }
+
+  return (ssize_t)copied;
+}
+
+// Moves the unread part of the input buffer to its start and reads more of
+// fd after it, so that a whole command can be looked at in place.
+// @param fd File descriptor to read from.
+// @return Number of bytes added, 0 if the buffer is full or on end of file,
+// -1 on error.
+static ssize_t fill_input(int fd) {
+  bind_input(fd);
+
+  if (input.pos > 0) {
+    memmove(input.data, input.data + input.pos, input.len - input.pos);
+    input.len -= input.pos;
+    input.pos = 0;
+  }
+
+  if (input.len == sizeof(input.data)) {
+    return 0;
+  }
+
+  ssize_t bytes_read =
+      read_input(fd, input.data + input.len, sizeof(input.data) - input.len);
+  if (bytes_read > 0) {
+    input.len += (size_t)bytes_read;
+  }
+  return bytes_read;
+}
 
 // Reads a string and indicates the position from where it was
 // extracted, based on the KVS specification.
@@ -20,7 +133,7 @@ static int read_string(int fd, char *buffer, size_t max) {
   int value = -1;
 
   while (i < max) {
-    bytes_read = read(fd, &ch, 1);
+    bytes_read = buffered_read(fd, &ch, 1);
 
     if (bytes_read <= 0) {
       return -1;
@@ -44,6 +157,10 @@ static int read_string(int fd, char *buffer, size_t max) {
     buffer[i++] = ch;
   }
 
+  if (value == -1) {
+    return -1; // string too long, buffer[max] is out of bounds
+  }
+
   buffer[i] = '\0';
 
   return value;
@@ -59,7 +176,7 @@ static int read_uint(int fd, unsigned int *value, char *next) {
 
   int i = 0;
   while (1) {
-    if (read(fd, buf + i, 1) == 0) {
+    if (buffered_read(fd, buf + i, 1) == 0) {
       *next = '\0';
       break;
     }
@@ -89,20 +206,20 @@ static int read_uint(int fd, unsigned int *value, char *next) {
 // @param fd File descriptor.
 static void cleanup(int fd) {
   char ch;
-  while (read(fd, &ch, 1) == 1 && ch != '\n')
+  while (buffered_read(fd, &ch, 1) == 1 && ch != '\n')
     ;
 }
 
 enum Command get_next(int fd) {
   char buf[16];
-  if (read(fd, buf, 1) != 1) {
+  if (buffered_read(fd, buf, 1) != 1) {
     return EOC;
   }
 
   switch (buf[0]) {
   case 'W':
-    if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
-      if (read(fd, buf + 5, 1) != 1 || strncmp(buf, "WRITE ", 6) != 0) {
+    if (buffered_read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
+      if (buffered_read(fd, buf + 5, 1) != 1 || strncmp(buf, "WRITE ", 6) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -112,7 +229,7 @@ enum Command get_next(int fd) {
     return CMD_WAIT;
 
   case 'R':
-    if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "READ ", 5) != 0) {
+    if (buffered_read(fd, buf + 1, 4) != 4 || strncmp(buf, "READ ", 5) != 0) {
       cleanup(fd);
       return CMD_INVALID;
     }
@@ -120,7 +237,7 @@ enum Command get_next(int fd) {
     return CMD_READ;
 
   case 'D':
-    if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "DELETE ", 7) != 0) {
+    if (buffered_read(fd, buf + 1, 6) != 6 || strncmp(buf, "DELETE ", 7) != 0) {
       cleanup(fd);
       return CMD_INVALID;
     }
@@ -128,12 +245,12 @@ enum Command get_next(int fd) {
     return CMD_DELETE;
 
   case 'S':
-    if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "SHOW", 4) != 0) {
+    if (buffered_read(fd, buf + 1, 3) != 3 || strncmp(buf, "SHOW", 4) != 0) {
       cleanup(fd);
       return CMD_INVALID;
     }
 
-    if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
+    if (buffered_read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
       cleanup(fd);
       return CMD_INVALID;
     }
@@ -141,12 +258,12 @@ enum Command get_next(int fd) {
     return CMD_SHOW;
 
   case 'B':
-    if (read(fd, buf + 1, 5) != 5 || strncmp(buf, "BACKUP", 6) != 0) {
+    if (buffered_read(fd, buf + 1, 5) != 5 || strncmp(buf, "BACKUP", 6) != 0) {
       cleanup(fd);
       return CMD_INVALID;
     }
 
-    if (read(fd, buf + 6, 1) != 0 && buf[6] != '\n') {
+    if (buffered_read(fd, buf + 6, 1) != 0 && buf[6] != '\n') {
       cleanup(fd);
       return CMD_INVALID;
     }
@@ -154,12 +271,12 @@ enum Command get_next(int fd) {
     return CMD_BACKUP;
 
   case 'H':
-    if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
+    if (buffered_read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
       cleanup(fd);
       return CMD_INVALID;
     }
 
-    if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
+    if (buffered_read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
       cleanup(fd);
       return CMD_INVALID;
     }
@@ -179,6 +296,205 @@ enum Command get_next(int fd) {
   }
 }
 
+// Outcome of scanning an argument list in place.
+enum ScanStatus {
+  SCAN_DONE,      // the list is valid
+  SCAN_FAILED,    // the list is invalid
+  SCAN_INCOMPLETE // the buffered input ends before the list does
+};
+
+// Where a scan stopped and, on failure, how many times the byte by byte
+// parser would have called cleanup from there.
+struct ScanResult {
+  const char *stop;
+  int cleanups;
+};
+
+static enum ScanStatus scan_failed(struct ScanResult *result, const char *stop,
+                                   int cleanups) {
+  result->stop = stop;
+  result->cleanups = cleanups;
+  return SCAN_FAILED;
+}
+
+// Scans a key or value the way read_string reads it.
+// @param scanner Delimiter scanner over the buffered input.
+// @param from Start of the string.
+// @param max Maximum string size.
+// @param span Where to store the string.
+// @param delimiter Where to store the delimiter that ended the string.
+// @param stop Where to store the position after the last consumed byte.
+// @return SCAN_DONE if the string ended in a delimiter, SCAN_FAILED if it
+// was longer than max, SCAN_INCOMPLETE if the input ran out first.
+static enum ScanStatus scan_string(struct DelimiterScanner *scanner,
+                                   const char *from, size_t max,
+                                   struct Span *span, char *delimiter,
+                                   const char **stop) {
+  size_t available = (size_t)(scanner->end - from);
+  const char *limit = from + (available < max ? available : max);
+  const char *hit = next_delimiter(scanner, from, limit);
+
+  if (hit == NULL) {
+    *stop = limit;
+    return available < max ? SCAN_INCOMPLETE : SCAN_FAILED;
+  }
+
+  span->start = from;
+  // a NUL inside the string ends it, as it did when keys were strcpy'd
+  span->len = strnlen(from, (size_t)(hit - from));
+  *delimiter = *hit;
+  *stop = hit + 1;
+  return SCAN_DONE;
+}
+
+// Scans the arguments of a WRITE command, [(key,value)(key2,value2),...],
+// from the buffered input, with the same outcome as the byte by byte parser.
+static enum ScanStatus scan_pairs(const char *start, const char *end,
+                                  struct Span *keys, struct Span *values,
+                                  size_t max_pairs, size_t max_string_size,
+                                  size_t *num_pairs,
+                                  struct ScanResult *result) {
+  struct DelimiterScanner scanner;
+  scanner_init(&scanner, end);
+  const char *p = start;
+  char delimiter;
+
+  if (p == end) {
+    return SCAN_INCOMPLETE;
+  }
+  if (*p++ != '[') {
+    return scan_failed(result, p, 1);
+  }
+
+  if (p == end) {
+    return SCAN_INCOMPLETE;
+  }
+  if (*p++ != '(') {
+    return scan_failed(result, p, 1);
+  }
+
+  *num_pairs = 0;
+  while (*num_pairs < max_pairs) {
+    switch (scan_string(&scanner, p, max_string_size, &keys[*num_pairs],
+                        &delimiter, &p)) {
+    case SCAN_INCOMPLETE:
+      return SCAN_INCOMPLETE;
+    case SCAN_FAILED:
+      return scan_failed(result, p, 2);
+    case SCAN_DONE:
+      break;
+    }
+    if (delimiter != ',') {
+      return scan_failed(result, p, 2);
+    }
+
+    switch (scan_string(&scanner, p, max_string_size, &values[*num_pairs],
+                        &delimiter, &p)) {
+    case SCAN_INCOMPLETE:
+      return SCAN_INCOMPLETE;
+    case SCAN_FAILED:
+      return scan_failed(result, p, 2);
+    case SCAN_DONE:
+      break;
+    }
+    if (delimiter != ')') {
+      return scan_failed(result, p, 2);
+    }
+    (*num_pairs)++;
+
+    if (p == end) {
+      return SCAN_INCOMPLETE;
+    }
+    char ch = *p++;
+    if (ch != '(' && ch != ']') {
+      return scan_failed(result, p, 1);
+    }
+    if (ch == ']') {
+      break;
+    }
+  }
+
+  if (*num_pairs == max_pairs) {
+    return scan_failed(result, p, 1);
+  }
+
+  if (p == end) {
+    return SCAN_INCOMPLETE;
+  }
+  if (*p != '\n' && *p != '\0') {
+    return scan_failed(result, p + 1, 1);
+  }
+
+  result->stop = p + 1;
+  return SCAN_DONE;
+}
+
+// Scans the arguments of a READ or DELETE command, [key,key2,...], from the
+// buffered input, with the same outcome as the byte by byte parser.
+static enum ScanStatus scan_keys(const char *start, const char *end,
+                                 struct Span *keys, size_t max_keys,
+                                 size_t max_string_size, size_t *num_keys,
+                                 struct ScanResult *result) {
+  struct DelimiterScanner scanner;
+  scanner_init(&scanner, end);
+  const char *p = start;
+  char delimiter = '\0';
+
+  if (p == end) {
+    return SCAN_INCOMPLETE;
+  }
+  if (*p++ != '[') {
+    return scan_failed(result, p, 1);
+  }
+
+  *num_keys = 0;
+  while (*num_keys < max_keys) {
+    switch (scan_string(&scanner, p, max_string_size, &keys[*num_keys],
+                        &delimiter, &p)) {
+    case SCAN_INCOMPLETE:
+      return SCAN_INCOMPLETE;
+    case SCAN_FAILED:
+      return scan_failed(result, p, 1);
+    case SCAN_DONE:
+      break;
+    }
+    if (delimiter == ' ' || delimiter == ')') {
+      return scan_failed(result, p, 1);
+    }
+    (*num_keys)++;
+
+    if (delimiter == ']') {
+      break;
+    }
+  }
+
+  if (*num_keys == max_keys) {
+    return scan_failed(result, p, 1);
+  }
+
+  if (p == end) {
+    return SCAN_INCOMPLETE;
+  }
+  if (*p != '\n' && *p != '\0') {
+    return scan_failed(result, p + 1, 1);
+  }
+
+  result->stop = p + 1;
+  return SCAN_DONE;
+}
+
+// Moves the input buffer past a scanned list, skipping to the following
+// lines like the byte by byte parser does when the list is invalid.
+static void finish_scan(int fd, const struct ScanResult *result,
+                        enum ScanStatus status) {
+  input.pos = (size_t)(result->stop - input.data);
+  if (status == SCAN_FAILED) {
+    for (int i = 0; i < result->cleanups; i++) {
+      cleanup(fd);
+    }
+  }
+}
+
 // Parses a key value pair.
 // @param fd File decriptor to read from.
 // @param key Pointer where the key will be stored
@@ -198,17 +514,19 @@ int parse_pair(int fd, char *key, char *value) {
   return 1;
 }
 
-size_t parse_write(int fd, char keys[][MAX_STRING_SIZE],
-                   char values[][MAX_STRING_SIZE], size_t max_pairs,
-                   size_t max_string_size) {
+// Parses the arguments of a WRITE command one byte at a time. Used when the
+// command does not fit in the input buffer.
+static size_t parse_write_bytewise(int fd, char keys[][MAX_STRING_SIZE],
+                                   char values[][MAX_STRING_SIZE],
+                                   size_t max_pairs, size_t max_string_size) {
   char ch;
 
-  if (read(fd, &ch, 1) != 1 || ch != '[') {
+  if (buffered_read(fd, &ch, 1) != 1 || ch != '[') {
     cleanup(fd);
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || ch != '(') {
+  if (buffered_read(fd, &ch, 1) != 1 || ch != '(') {
     cleanup(fd);
     return 0;
   }
@@ -225,7 +543,7 @@ size_t parse_write(int fd, char keys[][MAX_STRING_SIZE],
     strcpy(keys[num_pairs], key);
     strcpy(values[num_pairs++], value);
 
-    if (read(fd, &ch, 1) != 1 || (ch != '(' && ch != ']')) {
+    if (buffered_read(fd, &ch, 1) != 1 || (ch != '(' && ch != ']')) {
       cleanup(fd);
       return 0;
     }
@@ -240,7 +558,7 @@ size_t parse_write(int fd, char keys[][MAX_STRING_SIZE],
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+  if (buffered_read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
     cleanup(fd);
     return 0;
   }
@@ -248,11 +566,14 @@ size_t parse_write(int fd, char keys[][MAX_STRING_SIZE],
   return num_pairs;
 }
 
-size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
-                         size_t max_string_size) {
+// Parses the arguments of a READ or DELETE command one byte at a time. Used
+// when the command does not fit in the input buffer.
+static size_t parse_read_delete_bytewise(int fd, char keys[][MAX_STRING_SIZE],
+                                         size_t max_keys,
+                                         size_t max_string_size) {
   char ch;
 
-  if (read(fd, &ch, 1) != 1 || ch != '[') {
+  if (buffered_read(fd, &ch, 1) != 1 || ch != '[') {
     cleanup(fd);
     return 0;
   }
@@ -278,7 +599,7 @@ size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+  if (buffered_read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
     cleanup(fd);
     return 0;
   }
@@ -286,6 +607,55 @@ size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
   return num_keys;
 }
 
+size_t parse_write(int fd, struct Span keys[], struct Span values[],
+                   size_t max_pairs, size_t max_string_size) {
+  struct ScanResult result;
+  size_t num_pairs = 0;
+  enum ScanStatus status;
+
+  bind_input(fd);
+  while ((status = scan_pairs(input.data + input.pos, input.data + input.len,
+                              keys, values, max_pairs, max_string_size,
+                              &num_pairs, &result)) == SCAN_INCOMPLETE) {
+    if (fill_input(fd) <= 0) {
+      num_pairs = parse_write_bytewise(fd, long_keys, long_values, max_pairs,
+                                       max_string_size);
+      for (size_t i = 0; i < num_pairs; i++) {
+        keys[i] = (struct Span){long_keys[i], strlen(long_keys[i])};
+        values[i] = (struct Span){long_values[i], strlen(long_values[i])};
+      }
+      return num_pairs;
+    }
+  }
+
+  finish_scan(fd, &result, status);
+  return status == SCAN_DONE ? num_pairs : 0;
+}
+
+size_t parse_read_delete(int fd, struct Span keys[], size_t max_keys,
+                         size_t max_string_size) {
+  struct ScanResult result;
+  size_t num_keys = 0;
+  enum ScanStatus status;
+
+  bind_input(fd);
+  while ((status = scan_keys(input.data + input.pos, input.data + input.len,
+                             keys, max_keys, max_string_size, &num_keys,
+                             &result)) == SCAN_INCOMPLETE) {
+    if (fill_input(fd) <= 0) {
+      num_keys =
+          parse_read_delete_bytewise(fd, long_keys, max_keys, max_string_size);
+      for (size_t i = 0; i < num_keys; i++) {
+        keys[i] = (struct Span){long_keys[i], strlen(long_keys[i])};
+      }
+      return num_keys;
+    }
+  }
+
+  finish_scan(fd, &result, status);
+  return status == SCAN_DONE ? num_keys : 0;
+}
+
 int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
   char ch;
 
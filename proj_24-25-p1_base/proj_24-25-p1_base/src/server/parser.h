@@ -4,6 +4,7 @@
 #include <stddef.h>
 
 #include "constants.h"
+#include "span.h"
 
 enum Command {
   CMD_WRITE,
@@ -24,28 +25,40 @@ enum Command {
 // @return enum Command Command code.
 enum Command get_next(int fd);
 
-/// Parses a WRITE command.
+/// Parses a WRITE command. The spans stay valid until the next call to the
+/// parser on this thread.
 /// @param fd File descriptor to read from.
 /// @param keys Array to store the keys
 /// @param values Array to store the values
-/// @param max_pairs Maximum number of pairs it will write.
-/// @param max_string_size Maximum string size allowed.
+/// @param max_pairs Maximum number of pairs it will write, at most
+/// MAX_WRITE_SIZE.
+/// @param max_string_size Maximum string size allowed, at most
+/// MAX_STRING_SIZE.
 /// @return 0 if the command was not parsed successfully, otherwise return the
 //          of pairs parsed.
-size_t parse_write(int fd, char keys[][MAX_STRING_SIZE],
-                   char values[][MAX_STRING_SIZE], size_t max_pairs,
-                   size_t max_string_size);
+size_t parse_write(int fd, struct Span keys[], struct Span values[],
+                   size_t max_pairs, size_t max_string_size);
 
-// Parses a READ or a DELETE command.
+// Parses a READ or a DELETE command. The spans stay valid until the next call
+// to the parser on this thread.
 // @param fd File descriptor to read from.
 // @param keys Array to store the keys
-// @param max_pairs Maximum number of pairs it will write.
-// @param max_string_size Maximum string size allowed.
+// @param max_pairs Maximum number of pairs it will write, at most
+// MAX_WRITE_SIZE.
+// @param max_string_size Maximum string size allowed, at most
+// MAX_STRING_SIZE.
 // @return 0 if the command was not parsed successfully, otherwise return the
 //          of keys parsed
-size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
+size_t parse_read_delete(int fd, struct Span keys[], size_t max_keys,
                          size_t max_string_size);
 
+/// Gives the input this thread buffered from fd back to it, by moving the
+/// file offset to the first byte not parsed yet, so that another thread can
+/// go on parsing the file.
+/// @param fd File descriptor being parsed, of a regular file.
+/// @return 0 if successful, -1 if the file offset could not be moved.
+int parser_release(int fd);
+
 /// Parses a WAIT command.
 /// @param fd File descriptor to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
@@ -0,0 +1,1266 @@
+#include "session.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/constants.h"
+#include "../common/protocol.h"
+#include "../common/ring.h"
+#include "constants.h"
+#include "notify.h"
+#include "operations.h"
+#include "span.h"
+
+_Static_assert(SESSION_INPUT_SIZE >= MAX_FRAME_SIZE,
+               "a session must fit a whole request");
+_Static_assert(RING_MAX_MESSAGE >= MAX_FRAME_SIZE,
+               "a ring must fit a whole request");
+
+struct Session {
+  int req_pipe;   // read by the server, non-blocking
+  int resp_pipe;  // responses to the requests, req_pipe for a socket
+  int notif_pipe; // notifications, -1 until a socket client sends it
+  int notif_id;   // what its subscriptions refer to: notif_pipe, or that of
+                  // the session it resumed; -1 until registered
+  struct ShmChannel *shm; // rings shared with the client, NULL if none
+  int id;                 // unique session identifier (for debugging only)
+  uint64_t token;         // identifies the session to resume it
+  int resumed;            // 1 if it took over a detached session
+  int disconnected;       // 1 once the client sent DISCONNECT
+  uint32_t connect_id;    // request_id of the connect request of a pipe client
+  size_t in_len;          // bytes of in_buf holding requests not handled yet
+  char in_buf[SESSION_INPUT_SIZE];
+  char *out_buf;          // responses the client has not made room for yet
+  size_t out_len;
+  size_t out_cap;
+  int watching_in;  // 1 while the loop waits for requests
+  int watching_out; // 1 while the loop waits for room for out_buf
+  int closing;      // 1 once it only waits for out_buf to drain
+  int removed;      // 1 once closed, until the loop frees it
+  struct SessionLoop *loop; // loop serving the session
+  atomic_int evicted;       // set when it could not keep up with notifications
+  struct Session *prev;
+  struct Session *next;
+};
+
+// Event loop thread and the sessions it owns. Only the loop thread touches
+// its sessions; other threads hand new sessions over through pending and
+// wake the loop with wake_fd.
+struct SessionLoop {
+  int epoll_fd;
+  int wake_fd; // eventfd, registered with a NULL pointer
+  pthread_t thread;
+  struct Session *sessions; // sessions served by the loop
+
+  pthread_mutex_t lock;
+  struct Session *pending; // sessions not yet added to epoll_fd, under lock
+  atomic_int close_all;    // set to make the loop close all its sessions
+  atomic_int evictions;    // set when some of its sessions were evicted
+  // sessions closed while handling a batch of events, freed after it, as
+  // the other events of the batch may point to them
+  struct Session *removed;
+};
+
+static struct SessionLoop *loops = NULL;
+static size_t num_loops = 0;
+static atomic_size_t next_loop;
+static atomic_int session_count; // sessions ever added, for the ids
+
+// Session whose client lost its connection without disconnecting. Its
+// subscriptions and notifications are kept for the client to resume it,
+// until SESSION_DETACHED_MS pass or SESSION_MAX_DETACHED newer ones push it
+// out.
+struct Detached {
+  uint64_t token;
+  int notif_id;
+  struct timespec detached_at;
+  struct Detached *next;
+};
+
+static pthread_mutex_t detached_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct Detached *detached = NULL; // newest first, under detached_lock
+
+// Watches or stops watching a file descriptor of a session.
+// @return 0 on success, 1 otherwise.
+static int watch(struct Session *session, int fd, int on, uint32_t events) {
+  struct epoll_event event = {.events = events, .data.ptr = session};
+  return epoll_ctl(session->loop->epoll_fd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                   fd, &event) < 0;
+}
+
+// Makes the loop wait for what a session needs: requests, unless it is
+// closing or SESSION_OUTPUT_LIMIT bytes of responses wait for the client,
+// and room for the responses that wait. A client that sends requests
+// without reading the responses is thus only read once it catches up, and
+// never holds up the other sessions of the loop. The socket of a
+// shared-memory session is always read, as its client rings it both to send
+// requests and to report room for the responses.
+// @return 0 on success, 1 otherwise.
+static int update_events(struct Session *session) {
+  int want_in = session->shm != NULL ||
+                (!session->closing && session->out_len < SESSION_OUTPUT_LIMIT);
+  int want_out = session->shm == NULL && session->out_len > 0;
+
+  if (session->resp_pipe == session->req_pipe) {
+    // a socket is registered once, for both directions
+    if (want_in != session->watching_in || want_out != session->watching_out) {
+      struct epoll_event event = {
+          .events = (want_in ? EPOLLIN : 0) | (want_out ? EPOLLOUT : 0),
+          .data.ptr = session};
+      int op = !session->watching_in && !session->watching_out
+                   ? EPOLL_CTL_ADD
+                   : (want_in || want_out ? EPOLL_CTL_MOD : EPOLL_CTL_DEL);
+      if (epoll_ctl(session->loop->epoll_fd, op, session->req_pipe, &event) <
+          0) {
+        return 1;
+      }
+    }
+  } else if ((want_in != session->watching_in &&
+              watch(session, session->req_pipe, want_in, EPOLLIN) != 0) ||
+             (want_out != session->watching_out &&
+              watch(session, session->resp_pipe, want_out, EPOLLOUT) != 0)) {
+    return 1;
+  }
+
+  session->watching_in = want_in;
+  session->watching_out = want_out;
+  return 0;
+}
+
+// Writes as much of the waiting responses as the client has room for. A
+// socket or ring takes one whole response per write.
+// @return 0 on success, 1 if the client is gone.
+static int flush_output(struct Session *session) {
+  size_t pos = 0;
+  while (pos < session->out_len) {
+    size_t len = session->out_len - pos;
+    if (session->resp_pipe == session->req_pipe) {
+      struct FrameHeader header;
+      memcpy(&header, session->out_buf + pos, FRAME_HEADER_SIZE);
+      len = FRAME_HEADER_SIZE + header.length;
+    }
+
+    if (session->shm != NULL) {
+      if (!ring_has_room(&session->shm->resp, len)) {
+        break;
+      }
+      ring_push(&session->shm->resp, session->out_buf + pos, len);
+      pos += len;
+      continue;
+    }
+
+    ssize_t n = write(session->resp_pipe, session->out_buf + pos, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN) {
+      return 1;
+    }
+    if (n < 0) {
+      break;
+    }
+    pos += (size_t)n;
+  }
+
+  if (pos == 0) {
+    return 0;
+  }
+  session->out_len -= pos;
+  memmove(session->out_buf, session->out_buf + pos, session->out_len);
+  if (session->shm != NULL) {
+    ring_notify(&session->shm->resp);
+  }
+  return 0;
+}
+
+// Keeps bytes the client has no room for after the responses already
+// waiting for it.
+// @return 0 on success, 1 if memory ran out.
+static int keep_output(struct Session *session, const char *buf,
+                       size_t len) {
+  if (session->out_len + len > session->out_cap) {
+    size_t cap = session->out_cap > 0 ? session->out_cap : MAX_FRAME_SIZE;
+    while (cap < session->out_len + len) {
+      cap *= 2;
+    }
+    char *out_buf = realloc(session->out_buf, cap);
+    if (out_buf == NULL) {
+      return 1;
+    }
+    session->out_buf = out_buf;
+    session->out_cap = cap;
+  }
+  memcpy(session->out_buf + session->out_len, buf, len);
+  session->out_len += len;
+  return 0;
+}
+
+// Sends bytes to the client without waiting for it, keeping what it has
+// no room for until the loop sees it has.
+// @return 0 on success, 1 if the client is gone or memory ran out.
+static int queue_output(struct Session *session, const char *buf,
+                        size_t len) {
+  size_t sent = 0;
+  if (session->out_len == 0) {
+    ssize_t n;
+    do {
+      n = write(session->resp_pipe, buf, len);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && errno != EAGAIN) {
+      return 1;
+    }
+    sent = n > 0 ? (size_t)n : 0;
+  }
+  if (sent == len) {
+    return 0;
+  }
+  if (keep_output(session, buf + sent, len - sent) != 0) {
+    return 1;
+  }
+  return update_events(session);
+}
+
+// Sends the response to a request.
+// @param request_id Id of the request.
+// @param opcode Opcode of the request.
+// @param result Outcome of the request.
+// @param payload Payload of the response, at most MAX_FRAME_PAYLOAD bytes.
+// @param len Length of the payload.
+// @return 0 if the response was sent, 1 otherwise.
+static int send_response(struct Session *session, uint32_t request_id,
+                         uint8_t opcode, int result, const void *payload,
+                         size_t len) {
+  char buf[MAX_FRAME_SIZE];
+  struct FrameHeader header = {.length = (uint32_t)len,
+                               .request_id = request_id,
+                               .opcode = opcode,
+                               .result = (uint8_t)result};
+  memcpy(buf, &header, FRAME_HEADER_SIZE);
+  if (len > 0) {
+    memcpy(buf + FRAME_HEADER_SIZE, payload, len);
+  }
+
+  // the connect response goes through the socket, before the rings are
+  // used; a response the ring has no room for waits until the client pops
+  // some and rings the socket
+  if (session->shm != NULL && opcode != OP_CODE_CONNECT) {
+    if (session->out_len == 0 &&
+        ring_has_room(&session->shm->resp, FRAME_HEADER_SIZE + len)) {
+      ring_push(&session->shm->resp, buf, FRAME_HEADER_SIZE + len);
+      ring_notify(&session->shm->resp);
+      return 0;
+    }
+    return keep_output(session, buf, FRAME_HEADER_SIZE + len);
+  }
+
+  return queue_output(session, buf, FRAME_HEADER_SIZE + len);
+}
+
+// Removes the subscriptions of a client for good.
+// @param notif_id File descriptor they refer to, closed once they are gone.
+static void end_subscriptions(int notif_id) {
+  // no job queues notifications for it once this returns, and no
+  // dispatcher writes to it once notify_remove returns
+  kvs_unsubscribe_client(notif_id);
+  notify_remove(notif_id);
+  close(notif_id);
+}
+
+// Ends the detached sessions that expired or no longer fit. Only called
+// with detached_lock held.
+static void expire_detached(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  size_t kept = 0;
+  struct Detached **link = &detached;
+  while (*link != NULL) {
+    struct Detached *old = *link;
+    long elapsed_ms = (now.tv_sec - old->detached_at.tv_sec) * 1000 +
+                      (now.tv_nsec - old->detached_at.tv_nsec) / 1000000;
+    if (kept == SESSION_MAX_DETACHED || elapsed_ms >= SESSION_DETACHED_MS) {
+      *link = old->next;
+      end_subscriptions(old->notif_id);
+      free(old);
+      continue;
+    }
+    kept++;
+    link = &old->next;
+  }
+}
+
+// Keeps the subscriptions of a session whose client may resume it.
+// @return 0 if they are kept, 1 otherwise.
+static int detach_session(struct Session *session) {
+  struct Detached *old = malloc(sizeof(struct Detached));
+  if (old == NULL) {
+    return 1;
+  }
+
+  notify_detach(session->notif_id);
+  old->token = session->token;
+  old->notif_id = session->notif_id;
+  clock_gettime(CLOCK_MONOTONIC, &old->detached_at);
+
+  pthread_mutex_lock(&detached_lock);
+  old->next = detached;
+  detached = old;
+  expire_detached();
+  pthread_mutex_unlock(&detached_lock);
+  return 0;
+}
+
+// Closes a session of a loop. Its subscriptions are removed, unless the
+// client lost its connection and may come back for them.
+// @param may_resume 1 if the client may resume the session.
+static void remove_session(struct SessionLoop *loop, struct Session *session,
+                           int may_resume) {
+  printf("Removing client with id %d\n", session->id);
+
+  // closing the pipes takes them out of the epoll set
+  close(session->req_pipe);
+  if (session->resp_pipe != session->req_pipe) {
+    close(session->resp_pipe);
+  }
+
+  if (session->notif_id >= 0 &&
+      (!may_resume || session->disconnected ||
+       atomic_load(&session->evicted) || detach_session(session) != 0)) {
+    kvs_unsubscribe_client(session->notif_id);
+    notify_remove(session->notif_id);
+    close(session->notif_id);
+  }
+  if (session->shm != NULL) {
+    ring_close(&session->shm->resp);
+    ring_close(&session->shm->notif);
+    munmap(session->shm, sizeof(struct ShmChannel));
+  }
+  if (session->notif_pipe >= 0 && session->notif_pipe != session->notif_id) {
+    close(session->notif_pipe);
+  }
+
+  if (session->prev != NULL) {
+    session->prev->next = session->next;
+  } else {
+    loop->sessions = session->next;
+  }
+  if (session->next != NULL) {
+    session->next->prev = session->prev;
+  }
+  session->removed = 1;
+  session->next = loop->removed;
+  loop->removed = session;
+}
+
+// Closes a session whose client is gone or done. A client that sent
+// DISCONNECT gets the responses still waiting first.
+static void end_session(struct SessionLoop *loop, struct Session *session) {
+  if (session->disconnected && !session->closing && session->out_len > 0) {
+    session->closing = 1;
+    if (update_events(session) == 0) {
+      return;
+    }
+  }
+  remove_session(loop, session, 1);
+}
+
+// Maps the shared-memory segment a socket client sent instead of a
+// notification socket.
+// @return 0 if the rings are mapped, 1 otherwise.
+static int map_channel(struct Session *session) {
+  struct stat st;
+  if (fstat(session->notif_pipe, &st) < 0 || !S_ISREG(st.st_mode) ||
+      st.st_size < (off_t)sizeof(struct ShmChannel)) {
+    return 1;
+  }
+
+  void *shm = mmap(NULL, sizeof(struct ShmChannel), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, session->notif_pipe, 0);
+  if (shm == MAP_FAILED) {
+    perror("Failed to map client memory");
+    return 1;
+  }
+
+  session->shm = shm;
+  // the server is idle until the client rings the socket
+  atomic_store(&session->shm->req.sleeping, 1);
+  return 0;
+}
+
+static void signal_loop(struct SessionLoop *loop);
+
+// Has the loop of a session close it, once its notifications overflow.
+// Called by the thread writing to the KVS, so it only flags the session.
+static void evict_session(void *ctx) {
+  struct Session *session = ctx;
+  atomic_store(&session->evicted, 1);
+  atomic_store(&session->loop->evictions, 1);
+  signal_loop(session->loop);
+}
+
+// Draws the token of a new session from the kernel's random source, so a
+// client cannot guess the token of another one.
+// @return 0 on success, 1 otherwise.
+static int new_token(uint64_t *token) {
+  size_t got = 0;
+  while (got < sizeof(*token)) {
+    ssize_t n = getrandom((char *)token + got, sizeof(*token) - got, 0);
+    if (n < 0 && errno != EINTR) {
+      perror("Failed to generate session token");
+      return 1;
+    }
+    if (n > 0) {
+      got += (size_t)n;
+    }
+  }
+  return 0;
+}
+
+// Compares two tokens in time that does not depend on where they differ.
+// @return 1 if they are equal, 0 otherwise.
+static int same_token(uint64_t a, uint64_t b) {
+  unsigned char x[sizeof(a)], y[sizeof(b)];
+  unsigned char diff = 0;
+  memcpy(x, &a, sizeof(a));
+  memcpy(y, &b, sizeof(b));
+  for (size_t i = 0; i < sizeof(x); i++) {
+    diff |= x[i] ^ y[i];
+  }
+  return diff == 0;
+}
+
+// Registers the notification channel of a session, taking over the
+// subscriptions of the detached session it resumes, if it can.
+// @param resume Resume request of the client, NULL if none.
+// @return 0 if the channel is registered, 1 otherwise.
+static int attach_notifications(struct Session *session,
+                                const struct ResumeRequest *resume) {
+  if (resume != NULL) {
+    pthread_mutex_lock(&detached_lock);
+    expire_detached();
+    struct Detached **link = &detached;
+    while (*link != NULL && !same_token((*link)->token, resume->token)) {
+      link = &(*link)->next;
+    }
+    struct Detached *old = *link;
+    if (old != NULL) {
+      *link = old->next;
+    }
+    pthread_mutex_unlock(&detached_lock);
+
+    if (old != NULL &&
+        notify_resume(old->notif_id, session->notif_pipe, session->shm,
+                      resume->last_seq, evict_session, session) == 0) {
+      printf("Client %d resumed its session\n", session->id);
+      session->notif_id = old->notif_id;
+      session->token = old->token;
+      session->resumed = 1;
+      free(old);
+      return 0;
+    }
+    if (old != NULL) {
+      // the notifications the client missed are gone
+      end_subscriptions(old->notif_id);
+      free(old);
+    }
+  }
+
+  if (notify_add(session->notif_pipe, session->shm, evict_session, session) !=
+      0) {
+    return 1;
+  }
+  session->notif_id = session->notif_pipe;
+  return 0;
+}
+
+// Answers the connect request of a client.
+// @return 0 if the response was sent, 1 otherwise.
+static int send_connect_response(struct Session *session, uint32_t request_id,
+                                 int result) {
+  struct ConnectResponse response = {.token = session->token,
+                                     .resumed = (uint8_t)session->resumed};
+  return send_response(session, request_id, OP_CODE_CONNECT, result,
+                       &response, sizeof(response));
+}
+
+// Receives the connect request of a socket client, which carries the
+// notification socket or the shared-memory segment.
+// @return 0 to keep the session, 1 to close it.
+static int accept_notifications(struct Session *session) {
+  char req_buf[MAX_FRAME_SIZE];
+  struct FrameHeader header = {0};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct iovec iov = {.iov_base = req_buf, .iov_len = sizeof(req_buf)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control.buf,
+                       .msg_controllen = sizeof(control.buf)};
+
+  ssize_t n = recvmsg(session->req_pipe, &msg, MSG_CMSG_CLOEXEC);
+  if (n < 0) {
+    return errno == EAGAIN || errno == EINTR ? 0 : 1;
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+    memcpy(&session->notif_pipe, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  if ((size_t)n >= FRAME_HEADER_SIZE) {
+    memcpy(&header, req_buf, FRAME_HEADER_SIZE);
+  }
+  struct ResumeRequest resume;
+  int has_resume = header.length == sizeof(resume) &&
+                   (size_t)n >= FRAME_HEADER_SIZE + sizeof(resume);
+  if (has_resume) {
+    memcpy(&resume, req_buf + FRAME_HEADER_SIZE, sizeof(resume));
+  }
+
+  struct stat st;
+  int is_shm = session->notif_pipe >= 0 &&
+               fstat(session->notif_pipe, &st) == 0 && S_ISREG(st.st_mode);
+
+  if ((size_t)n < FRAME_HEADER_SIZE || header.opcode != OP_CODE_CONNECT ||
+      session->notif_pipe < 0 || (is_shm && map_channel(session) != 0) ||
+      attach_notifications(session, has_resume ? &resume : NULL) != 0) {
+    fprintf(stderr, "Invalid connect request from client %d\n", session->id);
+    send_connect_response(session, header.request_id, 1);
+    return 1;
+  }
+
+  return send_connect_response(session, header.request_id, 0);
+}
+
+// Splits the payload of a data request into its keys and values.
+// @param payload The payload.
+// @param len Length of the payload.
+// @param strings Set to the strings, pointing into the payload.
+// @param max Maximum number of strings.
+// @return Number of strings, 0 if the payload is malformed or holds more
+// than max strings.
+static size_t split_strings(const char *payload, size_t len,
+                            struct Span strings[], size_t max) {
+  size_t count = 0;
+  size_t pos = 0;
+
+  while (pos < len) {
+    size_t str_len = (unsigned char)payload[pos];
+    if (count == max || str_len > MAX_STRING_SIZE || len - pos - 1 < str_len) {
+      return 0;
+    }
+    strings[count].start = payload + pos + 1;
+    strings[count].len = str_len;
+    count++;
+    pos += 1 + str_len;
+  }
+  return count;
+}
+
+// Tells if keys can be stored in the table, which is indexed by their first
+// character.
+static int valid_keys(const struct Span keys[], size_t count, size_t stride) {
+  for (size_t i = 0; i < count; i += stride) {
+    if (keys[i].len == 0 || !isalnum((unsigned char)keys[i].start[0])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Appends a string to the payload of a response.
+// @param out The payload, with room for the string.
+// @param len Length of the payload so far, moved past the string.
+static void append_string(char *out, size_t *len, const char *str,
+                          size_t str_len) {
+  out[(*len)++] = (char)str_len;
+  memcpy(out + *len, str, str_len);
+  *len += str_len;
+}
+
+// Carries out a GET, PUT, DEL, MGET or MSET request and sends its response.
+static void process_data_request(struct Session *session,
+                                 const struct FrameHeader *header,
+                                 const char *payload) {
+  struct Span strings[2 * MAX_WRITE_SIZE];
+  char *values[MAX_WRITE_SIZE];
+  int missing[MAX_WRITE_SIZE];
+  char out[MAX_FRAME_PAYLOAD];
+  size_t out_len = 0;
+  int res = 0;
+
+  size_t count = split_strings(payload, header->length, strings,
+                               2 * MAX_WRITE_SIZE);
+  int is_pairs = header->opcode == OP_CODE_PUT || header->opcode == OP_CODE_MSET;
+  size_t num_keys = is_pairs ? count / 2 : count;
+
+  if (count == 0 || num_keys > MAX_WRITE_SIZE || (is_pairs && count % 2 != 0) ||
+      ((header->opcode == OP_CODE_GET || header->opcode == OP_CODE_PUT) &&
+       num_keys != 1) ||
+      !valid_keys(strings, count, is_pairs ? 2 : 1)) {
+    send_response(session, header->request_id, header->opcode, 1, NULL, 0);
+    return;
+  }
+
+  switch (header->opcode) {
+  case OP_CODE_GET:
+  case OP_CODE_MGET:
+    if (kvs_get_values(num_keys, strings, values) != 0) {
+      res = 1;
+      break;
+    }
+    for (size_t i = 0; i < num_keys; i++) {
+      if (values[i] == NULL) {
+        res = 1;
+        out[out_len++] = (char)FRAME_MISSING;
+      } else if (header->opcode == OP_CODE_GET) {
+        out_len = strlen(values[i]);
+        memcpy(out, values[i], out_len);
+      } else {
+        append_string(out, &out_len, values[i], strlen(values[i]));
+      }
+      free(values[i]);
+    }
+    if (header->opcode == OP_CODE_GET && res != 0) {
+      out_len = 0;
+    }
+    break;
+  case OP_CODE_PUT:
+  case OP_CODE_MSET: {
+    struct Span keys[MAX_WRITE_SIZE];
+    struct Span vals[MAX_WRITE_SIZE];
+    for (size_t i = 0; i < num_keys; i++) {
+      keys[i] = strings[2 * i];
+      vals[i] = strings[2 * i + 1];
+    }
+    res = kvs_write_spans(num_keys, keys, vals);
+    break;
+  }
+  case OP_CODE_DEL:
+    if (kvs_delete_keys(num_keys, strings, missing) != 0) {
+      res = 1;
+      break;
+    }
+    for (size_t i = 0; i < num_keys; i++) {
+      if (missing[i]) {
+        res = 1;
+        append_string(out, &out_len, strings[i].start, strings[i].len);
+      }
+    }
+    break;
+  default:
+    res = 1;
+    break;
+  }
+
+  send_response(session, header->request_id, header->opcode, res, out,
+                out_len);
+}
+
+// Carries out a request and sends its response.
+// @param header Header of the request.
+// @param payload Payload of the request, header->length bytes.
+// @return 0 to keep the session, 1 to close it.
+static int process_request(struct Session *session,
+                           const struct FrameHeader *header,
+                           const char *payload) {
+  char key[MAX_STRING_SIZE + 1];
+  int res = 1;
+
+  switch (header->opcode) {
+  case OP_CODE_DISCONNECT:
+    printf("Closing client\n");
+    session->disconnected = 1;
+    send_response(session, header->request_id, header->opcode, 0, NULL, 0);
+    return 1;
+  case OP_CODE_SUBSCRIBE:
+  case OP_CODE_UNSUBSCRIBE:
+    if (header->length <= MAX_STRING_SIZE) {
+      memcpy(key, payload, header->length);
+      key[header->length] = '\0';
+      res = header->opcode == OP_CODE_SUBSCRIBE
+                ? kvs_subscribe(key, session->notif_id)
+                : kvs_unsubscribe(key, session->notif_id);
+    }
+    send_response(session, header->request_id, header->opcode, res, NULL, 0);
+    break;
+  case OP_CODE_GET:
+  case OP_CODE_PUT:
+  case OP_CODE_DEL:
+  case OP_CODE_MGET:
+  case OP_CODE_MSET:
+    process_data_request(session, header, payload);
+    break;
+  default:
+    fprintf(stderr, "Error processing request: unknown opcode %d\n",
+            header->opcode);
+    send_response(session, header->request_id, header->opcode, 1, NULL, 0);
+    break;
+  }
+  return 0;
+}
+
+// Carries out the whole requests at the start of a buffer. A client may
+// send several requests without waiting, so a read can return more than
+// one, and the last one may be cut short.
+// @param buf Bytes received from the client.
+// @param len Number of bytes in buf.
+// @param used Set to the number of bytes of the requests carried out.
+// @return 0 to keep the session, 1 to close it.
+static int process_frames(struct Session *session, const char *buf,
+                          size_t len, size_t *used) {
+  *used = 0;
+  // the rest waits while the client does not take the responses
+  while (len - *used >= FRAME_HEADER_SIZE &&
+         session->out_len < SESSION_OUTPUT_LIMIT) {
+    struct FrameHeader header;
+    memcpy(&header, buf + *used, FRAME_HEADER_SIZE);
+
+    if (header.length > MAX_FRAME_PAYLOAD) {
+      fprintf(stderr, "Request too long from client %d\n", session->id);
+      return 1;
+    }
+    if (len - *used - FRAME_HEADER_SIZE < header.length) {
+      break;
+    }
+
+    if (process_request(session, &header, buf + *used + FRAME_HEADER_SIZE)) {
+      return 1;
+    }
+    *used += FRAME_HEADER_SIZE + header.length;
+  }
+  return 0;
+}
+
+// Handles the whole requests in the input buffer of a session, keeping a
+// partial request until the rest of it arrives.
+// @return 0 to keep the session, 1 to close it.
+static int process_input(struct Session *session) {
+  size_t used;
+  if (process_frames(session, session->in_buf, session->in_len, &used) != 0) {
+    return 1;
+  }
+  session->in_len -= used;
+  memmove(session->in_buf, session->in_buf + used, session->in_len);
+  return 0;
+}
+
+// Handles the requests in the ring of a shared-memory session. The client
+// only rings the socket when the server has said it is idle, so the server
+// keeps taking requests until the ring stays empty after saying so. Like a
+// pipe client, a client that does not take its responses is not read: no
+// request is taken while the response ring lacks room for the largest
+// response, and the client rings the socket once it makes some.
+// @return 0 to keep the session, 1 to close it.
+static int handle_shm_requests(struct Session *session) {
+  char buf[PIPE_BUF];
+  struct Ring *ring = &session->shm->req;
+  ssize_t n;
+
+  while ((n = read(session->req_pipe, buf, sizeof(buf))) > 0) {
+  }
+  if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+    return 1; // the client closed its end
+  }
+
+  if (flush_output(session) != 0) {
+    return 1;
+  }
+  if (session->closing) {
+    return 0;
+  }
+  // requests left over from a message cut short by the limit
+  if (session->in_len > 0 && process_input(session) != 0) {
+    return 1;
+  }
+
+  for (;;) {
+    if (session->out_len > 0 || session->in_len > 0 ||
+        !ring_has_room(&session->shm->resp, MAX_FRAME_SIZE)) {
+      return 0;
+    }
+
+    n = ring_pop(ring, session->in_buf, SESSION_INPUT_SIZE);
+    if (n < 0) {
+      if (atomic_load(&ring->sleeping)) {
+        return 0;
+      }
+      // a request pushed before this is seen by the next pop, and one
+      // pushed after it rings the socket
+      atomic_store(&ring->sleeping, 1);
+      continue;
+    }
+    atomic_store(&ring->sleeping, 0);
+
+    // each message in the ring is a whole number of requests
+    if (n > SESSION_INPUT_SIZE) {
+      return 1;
+    }
+    session->in_len = (size_t)n;
+    if (process_input(session) != 0) {
+      return 1;
+    }
+    if (session->in_len > 0 && session->out_len < SESSION_OUTPUT_LIMIT) {
+      return 1; // a request cut short
+    }
+  }
+}
+
+// Handles the requests waiting in the request pipe of a session, keeping
+// a partial request until the rest of it arrives.
+// @return 0 to keep the session, 1 to close it.
+static int handle_request(struct Session *session) {
+  if (session->notif_pipe < 0) {
+    return accept_notifications(session);
+  }
+  if (session->shm != NULL) {
+    return handle_shm_requests(session);
+  }
+
+  ssize_t n = read(session->req_pipe, session->in_buf + session->in_len,
+                   SESSION_INPUT_SIZE - session->in_len);
+
+  if (n < 0) {
+    return errno == EAGAIN || errno == EINTR ? 0 : 1;
+  }
+  if (n == 0) {
+    return 1; // the client closed its end
+  }
+  session->in_len += (size_t)n;
+  return process_input(session);
+}
+
+// Writes the responses waiting for the client, and handles the requests
+// held back while they waited.
+// @return 0 to keep the session, 1 to close it.
+static int handle_output(struct Session *session) {
+  if (flush_output(session) != 0) {
+    return 1;
+  }
+  if (!session->closing && session->out_len < SESSION_OUTPUT_LIMIT &&
+      session->in_len > 0 && process_input(session) != 0) {
+    return 1;
+  }
+  return update_events(session);
+}
+
+
+// Starts serving the sessions handed over to a loop, closes the evicted
+// ones, and closes all of them if asked to.
+static void wake_loop(struct SessionLoop *loop) {
+  uint64_t count;
+  if (read(loop->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    perror("Failed to read session wake event");
+  }
+
+  pthread_mutex_lock(&loop->lock);
+  struct Session *pending = loop->pending;
+  loop->pending = NULL;
+  pthread_mutex_unlock(&loop->lock);
+
+  while (pending != NULL) {
+    struct Session *session = pending;
+    pending = session->next;
+
+    session->prev = NULL;
+    session->next = loop->sessions;
+    if (loop->sessions != NULL) {
+      loop->sessions->prev = session;
+    }
+    loop->sessions = session;
+
+    // socket clients are answered once they send their connect request
+    if (update_events(session) != 0 ||
+        (session->notif_pipe >= 0 &&
+         send_connect_response(session, session->connect_id, 0) != 0)) {
+      perror("Failed to start session");
+      remove_session(loop, session, 1);
+    }
+  }
+
+  if (atomic_exchange(&loop->evictions, 0)) {
+    struct Session *session = loop->sessions;
+    while (session != NULL) {
+      struct Session *next = session->next;
+      if (atomic_load(&session->evicted)) {
+        fprintf(stderr, "Client %d does not keep up with notifications\n",
+                session->id);
+        remove_session(loop, session, 0);
+      }
+      session = next;
+    }
+  }
+
+  if (atomic_exchange(&loop->close_all, 0)) {
+    while (loop->sessions != NULL) {
+      remove_session(loop, loop->sessions, 0);
+    }
+  }
+}
+
+static void *run_loop(void *arg) {
+  struct SessionLoop *loop = arg;
+  struct epoll_event events[SESSION_MAX_EVENTS];
+
+  for (;;) {
+    int n = epoll_wait(loop->epoll_fd, events, SESSION_MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Failed to wait for session events");
+      return NULL;
+    }
+
+    for (int i = 0; i < n; i++) {
+      struct Session *session = events[i].data.ptr;
+      uint32_t ready = events[i].events;
+      if (session == NULL) {
+        wake_loop(loop);
+        continue;
+      }
+      if (session->removed) {
+        continue;
+      }
+
+      int done = 0;
+      if ((ready & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && session->out_len > 0) {
+        done = handle_output(session);
+      }
+      if (!done && (ready & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+          session->watching_in) {
+        done = handle_request(session);
+      }
+      if (done || (session->closing && session->out_len == 0)) {
+        end_session(loop, session);
+      }
+    }
+
+    while (loop->removed != NULL) {
+      struct Session *session = loop->removed;
+      loop->removed = session->next;
+      free(session->out_buf);
+      free(session);
+    }
+  }
+}
+
+int session_start(size_t count) {
+  if (count == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    count = cores > 0 ? (size_t)cores : 1;
+  }
+
+  loops = calloc(count, sizeof(struct SessionLoop));
+  if (loops == NULL) {
+    fprintf(stderr, "Failed to allocate memory for session loops\n");
+    return 1;
+  }
+  atomic_init(&next_loop, 0);
+  atomic_init(&session_count, 0);
+
+  for (size_t i = 0; i < count; i++) {
+    struct SessionLoop *loop = &loops[i];
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->epoll_fd < 0 || loop->wake_fd < 0) {
+      perror("Failed to create session loop");
+      return 1;
+    }
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) < 0) {
+      perror("Failed to create session loop");
+      return 1;
+    }
+
+    pthread_mutex_init(&loop->lock, NULL);
+    atomic_init(&loop->close_all, 0);
+    atomic_init(&loop->evictions, 0);
+
+    if (pthread_create(&loop->thread, NULL, run_loop, loop) != 0) {
+      fprintf(stderr, "Failed to create session thread %zu\n", i);
+      return 1;
+    }
+    num_loops = i + 1;
+  }
+
+  return 0;
+}
+
+// Wakes a loop up to look at its pending sessions, evictions and close_all.
+static void signal_loop(struct SessionLoop *loop) {
+  uint64_t one = 1;
+  if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+    perror("Failed to wake session loop");
+  }
+}
+
+int session_add(int req_pipe, int resp_pipe, int notif_pipe,
+                uint32_t request_id, const struct ResumeRequest *resume) {
+  struct Session *session = malloc(sizeof(struct Session));
+  struct SessionLoop *loop =
+      num_loops > 0 ? &loops[atomic_fetch_add(&next_loop, 1) % num_loops]
+                    : NULL;
+  if (session != NULL) {
+    session->req_pipe = req_pipe;
+    session->resp_pipe = resp_pipe;
+    session->notif_pipe = notif_pipe;
+    session->notif_id = -1;
+    session->shm = NULL;
+    session->in_len = 0;
+    session->out_buf = NULL;
+    session->out_len = 0;
+    session->out_cap = 0;
+    session->watching_in = 0;
+    session->watching_out = 0;
+    session->closing = 0;
+    session->removed = 0;
+    session->loop = loop;
+    session->id = atomic_fetch_add(&session_count, 1);
+    session->resumed = 0;
+    session->disconnected = 0;
+    session->connect_id = request_id;
+    atomic_init(&session->evicted, 0);
+  }
+
+  if (session == NULL || loop == NULL ||
+      fcntl(req_pipe, F_SETFL, fcntl(req_pipe, F_GETFL) | O_NONBLOCK) < 0 ||
+      new_token(&session->token) != 0 ||
+      (notif_pipe >= 0 && attach_notifications(session, resume) != 0)) {
+    fprintf(stderr, "Failed to add client\n");
+    free(session);
+    close(req_pipe);
+    if (resp_pipe != req_pipe) {
+      close(resp_pipe);
+    }
+    if (notif_pipe >= 0) {
+      close(notif_pipe);
+    }
+    return 1;
+  }
+
+  printf("Client added: %d\n", session->id);
+
+  pthread_mutex_lock(&loop->lock);
+  session->next = loop->pending;
+  loop->pending = session;
+  pthread_mutex_unlock(&loop->lock);
+
+  signal_loop(loop);
+  return 0;
+}
+
+// Connection whose pipes are not all open yet. The client opens the request
+// pipe first, then the response and notification pipes, each open waiting
+// for the server to open the other end.
+struct Handshake {
+  char req_path[MAX_PIPE_PATH_LENGTH + 1];
+  char resp_path[MAX_PIPE_PATH_LENGTH + 1];
+  char notif_path[MAX_PIPE_PATH_LENGTH + 1];
+  int req_pipe;
+  int resp_pipe; // -1 until the client opens its end
+  int notif_pipe;
+  uint32_t request_id; // of the connect request
+  struct ResumeRequest resume;
+  int has_resume; // 1 if the client asked to resume a session
+  struct timespec deadline;
+  struct Handshake *next;
+};
+
+static struct Handshake *handshakes = NULL; // only used by the host thread
+
+// Opens the write end of a pipe without waiting for the reader.
+// @param path Path of the pipe.
+// @param fd Set to the file descriptor once the reader is there.
+// @return 0 if the pipe is open or the reader is not there yet, 1 on error.
+static int open_writer(const char *path, int *fd) {
+  if (*fd >= 0) {
+    return 0;
+  }
+
+  *fd = open(path, O_WRONLY | O_NONBLOCK);
+  if (*fd < 0) {
+    return errno == ENXIO ? 0 : 1;
+  }
+
+  // stays non-blocking: the loop queues the responses the client has no
+  // room for, and notify_add expects a non-blocking notification pipe
+  printf("Pipe opened: %s\n", path);
+  return 0;
+}
+
+// Closes the pipes of a handshake that will not finish.
+static void drop_handshake(struct Handshake *handshake) {
+  close(handshake->req_pipe);
+  if (handshake->resp_pipe >= 0) {
+    close(handshake->resp_pipe);
+  }
+  if (handshake->notif_pipe >= 0) {
+    close(handshake->notif_pipe);
+  }
+  free(handshake);
+}
+
+int session_connect(const char *req_path, const char *resp_path,
+                    const char *notif_path, uint32_t request_id,
+                    const struct ResumeRequest *resume) {
+  struct Handshake *handshake = malloc(sizeof(struct Handshake));
+  if (handshake == NULL) {
+    fprintf(stderr, "Failed to allocate memory for client\n");
+    return 1;
+  }
+
+  strncpy(handshake->req_path, req_path, MAX_PIPE_PATH_LENGTH);
+  handshake->req_path[MAX_PIPE_PATH_LENGTH] = '\0';
+  strncpy(handshake->resp_path, resp_path, MAX_PIPE_PATH_LENGTH);
+  handshake->resp_path[MAX_PIPE_PATH_LENGTH] = '\0';
+  strncpy(handshake->notif_path, notif_path, MAX_PIPE_PATH_LENGTH);
+  handshake->notif_path[MAX_PIPE_PATH_LENGTH] = '\0';
+  handshake->resp_pipe = -1;
+  handshake->notif_pipe = -1;
+  handshake->request_id = request_id;
+  handshake->has_resume = resume != NULL;
+  if (resume != NULL) {
+    handshake->resume = *resume;
+  }
+
+  // opening the read end does not wait for the writer
+  handshake->req_pipe = open(handshake->req_path, O_RDONLY | O_NONBLOCK);
+  if (handshake->req_pipe < 0) {
+    perror("Error opening the named pipe");
+    free(handshake);
+    return 1;
+  }
+  printf("Pipe opened: %s\n", handshake->req_path);
+
+  clock_gettime(CLOCK_MONOTONIC, &handshake->deadline);
+  handshake->deadline.tv_sec += HANDSHAKE_TIMEOUT_MS / 1000;
+  handshake->deadline.tv_nsec += (HANDSHAKE_TIMEOUT_MS % 1000) * 1000000L;
+  if (handshake->deadline.tv_nsec >= 1000000000) {
+    handshake->deadline.tv_sec++;
+    handshake->deadline.tv_nsec -= 1000000000;
+  }
+
+  handshake->next = handshakes;
+  handshakes = handshake;
+  return 0;
+}
+
+int session_handshake(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  struct Handshake **link = &handshakes;
+  while (*link != NULL) {
+    struct Handshake *handshake = *link;
+
+    // the client opens the notification pipe after the response pipe
+    int failed = open_writer(handshake->resp_path, &handshake->resp_pipe) ||
+                 (handshake->resp_pipe >= 0 &&
+                  open_writer(handshake->notif_path, &handshake->notif_pipe));
+
+    if (!failed && handshake->notif_pipe >= 0) {
+      *link = handshake->next;
+      session_add(handshake->req_pipe, handshake->resp_pipe,
+                  handshake->notif_pipe, handshake->request_id,
+                  handshake->has_resume ? &handshake->resume : NULL);
+      free(handshake);
+      continue;
+    }
+
+    if (failed || now.tv_sec > handshake->deadline.tv_sec ||
+        (now.tv_sec == handshake->deadline.tv_sec &&
+         now.tv_nsec >= handshake->deadline.tv_nsec)) {
+      if (failed) {
+        perror("Error opening the named pipe");
+      } else {
+        fprintf(stderr, "Client did not open its pipes: %s\n",
+                handshake->req_path);
+      }
+      *link = handshake->next;
+      drop_handshake(handshake);
+      continue;
+    }
+
+    link = &handshake->next;
+  }
+
+  return handshakes != NULL ? HANDSHAKE_RETRY_MS : -1;
+}
+
+int session_listen(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("Error creating socket");
+    return -1;
+  }
+
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    perror("Error listening on socket");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int session_accept(int listen_fd) {
+  int fd = accept(listen_fd, NULL, NULL);
+  if (fd < 0) {
+    if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+      perror("Error accepting client");
+    }
+    return 1;
+  }
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return session_add(fd, fd, -1, 0, NULL);
+}
+
+void session_close_all(void) {
+  pthread_mutex_lock(&detached_lock);
+  while (detached != NULL) {
+    struct Detached *old = detached;
+    detached = old->next;
+    end_subscriptions(old->notif_id);
+    free(old);
+  }
+  pthread_mutex_unlock(&detached_lock);
+
+  for (size_t i = 0; i < num_loops; i++) {
+    atomic_store(&loops[i].close_all, 1);
+    signal_loop(&loops[i]);
+  }
+}
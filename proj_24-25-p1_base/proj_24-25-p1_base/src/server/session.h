@@ -0,0 +1,72 @@
+#ifndef KVS_SESSION_H
+#define KVS_SESSION_H
+
+#include <stddef.h>
+
+#include "../common/protocol.h"
+
+/// Client sessions. Each session is owned by one of a few event loop
+/// threads, one per core, which wait on the request pipes of all their
+/// sessions with epoll and handle every request as it arrives. An idle
+/// session costs its file descriptors and no thread.
+
+/// Starts the event loop threads.
+/// @param num_loops Number of loops, 0 for one per online core.
+/// @return 0 if the loops were started, 1 otherwise.
+int session_start(size_t num_loops);
+
+/// Hands a connected client over to one of the loops, which answers its
+/// connect request and serves it from then on.
+/// @param req_pipe Request pipe, read by the server.
+/// @param resp_pipe Response pipe, req_pipe for a socket client.
+/// @param notif_pipe Notification pipe, -1 for a socket client, which sends
+/// its notification socket along with its connect request.
+/// @param request_id Id of the connect request of a pipe client, echoed in
+/// the response.
+/// @param resume Resume request of a pipe client, NULL if none.
+/// @return 0 if the session was added, 1 otherwise (the pipes are closed).
+int session_add(int req_pipe, int resp_pipe, int notif_pipe,
+                uint32_t request_id, const struct ResumeRequest *resume);
+
+/// Starts connecting a client that registered with the server. The pipes
+/// are opened without waiting for the client, so a client that never opens
+/// its ends does not hold up the others; it is dropped after
+/// HANDSHAKE_TIMEOUT_MS. Only the host thread may call this and
+/// session_handshake.
+/// @param req_path Path of the request pipe.
+/// @param resp_path Path of the response pipe.
+/// @param notif_path Path of the notification pipe.
+/// @param request_id Id of the connect request.
+/// @param resume Resume request of the client, NULL if none.
+/// @return 0 if the connection is under way, 1 otherwise.
+int session_connect(const char *req_path, const char *resp_path,
+                    const char *notif_path, uint32_t request_id,
+                    const struct ResumeRequest *resume);
+
+/// Opens the pipes the pending clients have opened their ends of since the
+/// last call, handing finished connections to the loops and dropping the
+/// ones that timed out.
+/// @return Milliseconds until the next call, -1 if no client is pending.
+int session_handshake(void);
+
+/// Creates a Unix SOCK_SEQPACKET socket listening for clients. Each message
+/// on it is one request or response, and the client passes a second socket
+/// for the notifications with its connect request. A client may pass a
+/// shared-memory segment instead (see ../common/ring.h), in which case the
+/// requests, responses and notifications go through rings in the segment
+/// and the socket is only written to wake the server up.
+/// @param path Path of the socket, replaced if it exists.
+/// @return The listening socket, -1 on failure.
+int session_listen(const char *path);
+
+/// Accepts a client waiting on a listening socket and hands it over to the
+/// loops.
+/// @param listen_fd Socket created by session_listen.
+/// @return 0 if a client was added, 1 otherwise.
+int session_accept(int listen_fd);
+
+/// Closes every session, removing its subscriptions. Each loop closes its
+/// own sessions, so this returns before they are all closed.
+void session_close_all(void);
+
+#endif // KVS_SESSION_H
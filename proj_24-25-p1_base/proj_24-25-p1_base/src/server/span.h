@@ -0,0 +1,13 @@
+#ifndef KVS_SPAN_H
+#define KVS_SPAN_H
+
+#include <stddef.h>
+
+/// A string given by its start and length, usually pointing into the job
+/// parser's input buffer. Not NUL terminated.
+struct Span {
+  const char *start;
+  size_t len;
+};
+
+#endif // KVS_SPAN_H
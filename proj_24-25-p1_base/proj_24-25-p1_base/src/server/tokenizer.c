@@ -0,0 +1,128 @@
+#include "tokenizer.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+#define BLOCK_SIZE 64
+
+// Tells if a character ends a key or a value inside an argument list.
+// @param ch Character to test.
+// @return 1 if it is a delimiter, 0 otherwise.
+static int is_delimiter(char ch) {
+  return ch == ' ' || ch == ',' || ch == ')' || ch == ']';
+}
+
+// Computes the delimiter mask of the first len bytes of a block.
+// @param block Start of the block.
+// @param len Number of bytes to look at, at most BLOCK_SIZE.
+// @return Mask with bit i set if block[i] is a delimiter.
+static uint64_t partial_mask(const char *block, size_t len) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (is_delimiter(block[i])) {
+      mask |= (uint64_t)1 << i;
+    }
+  }
+  return mask;
+}
+
+static uint64_t block_mask_scalar(const char *block) {
+  return partial_mask(block, BLOCK_SIZE);
+}
+
+#ifdef TOKENIZER_X86
+__attribute__((target("sse2"))) static uint64_t
+block_mask_sse2(const char *block) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i paren = _mm_set1_epi8(')');
+  const __m128i bracket = _mm_set1_epi8(']');
+  uint64_t mask = 0;
+
+  for (int i = 0; i < BLOCK_SIZE / 16; i++) {
+    __m128i chunk = _mm_loadu_si128((const void *)(block + 16 * i));
+    __m128i hits =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+                                  _mm_cmpeq_epi8(chunk, comma)),
+                     _mm_or_si128(_mm_cmpeq_epi8(chunk, paren),
+                                  _mm_cmpeq_epi8(chunk, bracket)));
+    mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(hits) << (16 * i);
+  }
+
+  return mask;
+}
+
+__attribute__((target("avx2"))) static uint64_t
+block_mask_avx2(const char *block) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i paren = _mm256_set1_epi8(')');
+  const __m256i bracket = _mm256_set1_epi8(']');
+  uint64_t mask = 0;
+
+  for (int i = 0; i < BLOCK_SIZE / 32; i++) {
+    __m256i chunk = _mm256_loadu_si256((const void *)(block + 32 * i));
+    __m256i hits = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+                        _mm256_cmpeq_epi8(chunk, comma)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, paren),
+                        _mm256_cmpeq_epi8(chunk, bracket)));
+    mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(hits) << (32 * i);
+  }
+
+  return mask;
+}
+#endif
+
+static uint64_t (*block_mask)(const char *block) = block_mask_scalar;
+static pthread_once_t block_mask_once = PTHREAD_ONCE_INIT;
+
+// Picks the widest delimiter search the CPU supports.
+static void select_block_mask(void) {
+#ifdef TOKENIZER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    block_mask = block_mask_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    block_mask = block_mask_sse2;
+  }
+#endif
+}
+
+void scanner_init(struct DelimiterScanner *scanner, const char *end) {
+  pthread_once(&block_mask_once, select_block_mask);
+  scanner->block = NULL;
+  scanner->end = end;
+  scanner->mask = 0;
+}
+
+const char *next_delimiter(struct DelimiterScanner *scanner, const char *from,
+                           const char *limit) {
+  while (from < limit) {
+    if (scanner->block == NULL ||
+        (size_t)(from - scanner->block) >= BLOCK_SIZE) {
+      size_t left = (size_t)(scanner->end - from);
+      scanner->block = from;
+      scanner->mask = left >= BLOCK_SIZE ? block_mask(from)
+                                         : partial_mask(from, left);
+    }
+
+    size_t offset = (size_t)(from - scanner->block);
+    uint64_t bits = scanner->mask >> offset;
+    if (bits != 0) {
+      const char *hit = from + __builtin_ctzll(bits);
+      return hit < limit ? hit : NULL;
+    }
+
+    if ((size_t)(scanner->end - scanner->block) <= BLOCK_SIZE) {
+      return NULL; // the window already reaches the end
+    }
+    from = scanner->block + BLOCK_SIZE;
+  }
+
+  return NULL;
+}
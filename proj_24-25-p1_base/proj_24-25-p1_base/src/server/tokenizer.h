@@ -0,0 +1,29 @@
+#ifndef KVS_TOKENIZER_H
+#define KVS_TOKENIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Finds the delimiters of a WRITE/READ/DELETE argument list (' ', ',', ')'
+/// and ']') in a block of memory, 64 bytes at a time.
+struct DelimiterScanner {
+  const char *block; // start of the window covered by mask, NULL if none yet
+  const char *end;   // end of the memory being scanned
+  uint64_t mask;     // bit i is set if block[i] is a delimiter
+};
+
+/// Prepares a scanner over [start, end).
+/// @param scanner Scanner to initialize.
+/// @param end End of the memory that may be scanned.
+void scanner_init(struct DelimiterScanner *scanner, const char *end);
+
+/// Returns the first delimiter in [from, limit). Successive calls must use
+/// non decreasing values of from.
+/// @param scanner Scanner to search with.
+/// @param from Where to start searching.
+/// @param limit Where to stop searching, at most the end of the scanner.
+/// @return Pointer to the delimiter, NULL if there is none before limit.
+const char *next_delimiter(struct DelimiterScanner *scanner, const char *from,
+                           const char *limit);
+
+#endif // KVS_TOKENIZER_H
@@ -0,0 +1,480 @@
+// syscall and MAP_ANONYMOUS are not part of POSIX
+#define _GNU_SOURCE
+
+#include "uring.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define URING_SUPPORTED 1
+#endif
+#endif
+
+static atomic_int enabled = 0;
+
+void uring_enable(void) { atomic_store(&enabled, 1); }
+
+#ifdef URING_SUPPORTED
+
+#define URING_ENTRIES 16
+#define URING_WRITE_SLOTS 8
+#define AHEAD_TAG URING_WRITE_SLOTS // user_data of the read ahead
+#define NO_OFFSET ((__u64)-1)       // use and move the file position
+
+// Write queued in a ring.
+struct WriteSlot {
+  int fd; // -1 if the slot is free
+  struct iovec iov[URING_MAX_IOV];
+  int iovcnt;
+  char *owned[URING_MAX_IOV];
+  size_t num_owned;
+  size_t total; // bytes to write
+};
+
+struct Ring {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size, sqes_size;
+
+  struct WriteSlot writes[URING_WRITE_SLOTS];
+
+  // block of a job file read ahead of the parser
+  int ahead_fd; // -1 if none
+  int ahead_fixed; // 1 if the block is a registered buffer
+  int ahead_pending;
+  ssize_t ahead_res;
+  size_t ahead_pos;
+  size_t ahead_len;
+  char ahead[PARSER_BUFFER_SIZE];
+};
+
+// Ring of the calling thread. It is mapped rather than allocated with
+// malloc, so that a backup child, which can only use async signal safe
+// functions, can create its own.
+static _Thread_local struct Ring *ring = NULL;
+static _Thread_local int ring_failed = 0;
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                           unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static int sys_uring_register(int fd, unsigned opcode, void *arg,
+                              unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Unmaps the memory of a ring.
+static void unmap_ring(struct Ring *r) {
+  if (r->sqes != NULL && r->sqes != MAP_FAILED) {
+    munmap(r->sqes, r->sqes_size);
+  }
+  if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED &&
+      r->cq_ring != r->sq_ring) {
+    munmap(r->cq_ring, r->cq_ring_size);
+  }
+  if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED) {
+    munmap(r->sq_ring, r->sq_ring_size);
+  }
+  munmap(r, sizeof(struct Ring));
+}
+
+// Creates the ring of the calling thread.
+// @return 0 if successful, -1 if io_uring can not be used.
+static int create_ring(void) {
+  struct Ring *r = mmap(NULL, sizeof(struct Ring), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (r == MAP_FAILED) {
+    return -1;
+  }
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  r->fd = sys_uring_setup(URING_ENTRIES, &params);
+  if (r->fd < 0) {
+    munmap(r, sizeof(struct Ring));
+    return -1;
+  }
+
+  // reads and writes at the file position need IORING_FEAT_RW_CUR_POS
+  if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+    close(r->fd);
+    munmap(r, sizeof(struct Ring));
+    return -1;
+  }
+
+  r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  r->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_ring_size > r->sq_ring_size) {
+      r->sq_ring_size = r->cq_ring_size;
+    }
+    r->cq_ring_size = r->sq_ring_size;
+  }
+
+  r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    r->fd, IORING_OFF_SQ_RING);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    r->cq_ring = r->sq_ring;
+  } else {
+    r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, r->fd, IORING_OFF_CQ_RING);
+  }
+  r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 r->fd, IORING_OFF_SQES);
+
+  if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED ||
+      r->sqes == MAP_FAILED) {
+    close(r->fd);
+    unmap_ring(r);
+    return -1;
+  }
+
+  char *sq = r->sq_ring;
+  char *cq = r->cq_ring;
+  r->sq_head = (unsigned *)(void *)(sq + params.sq_off.head);
+  r->sq_tail = (unsigned *)(void *)(sq + params.sq_off.tail);
+  r->sq_mask = (unsigned *)(void *)(sq + params.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(void *)(sq + params.sq_off.array);
+  r->cq_head = (unsigned *)(void *)(cq + params.cq_off.head);
+  r->cq_tail = (unsigned *)(void *)(cq + params.cq_off.tail);
+  r->cq_mask = (unsigned *)(void *)(cq + params.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(void *)(cq + params.cq_off.cqes);
+
+  for (size_t i = 0; i < URING_WRITE_SLOTS; i++) {
+    r->writes[i].fd = -1;
+  }
+  r->ahead_fd = -1;
+
+  // reading into a registered buffer saves mapping it on every read
+  struct iovec ahead = {r->ahead, sizeof(r->ahead)};
+  r->ahead_fixed =
+      sys_uring_register(r->fd, IORING_REGISTER_BUFFERS, &ahead, 1) == 0;
+
+  ring = r;
+  return 0;
+}
+
+int uring_active(void) {
+  if (ring != NULL) {
+    return 1;
+  }
+  if (ring_failed || !atomic_load(&enabled)) {
+    return 0;
+  }
+
+  if (create_ring() != 0) {
+    ring_failed = 1;
+    return 0;
+  }
+  return 1;
+}
+
+// Queues a submission and hands it to the kernel.
+// @param sqe Filled in submission, user_data included.
+static void submit(const struct io_uring_sqe *sqe) {
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+
+  // at most URING_WRITE_SLOTS + 1 requests are in flight, fewer than
+  // URING_ENTRIES, so there is always room
+  ring->sqes[index] = *sqe;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  while (sys_uring_enter(ring->fd, 1, 0, 0) < 0 && errno == EINTR) {
+  }
+}
+
+// Writes what the kernel left of a short write, the slow way.
+// @param slot The write.
+// @param written Bytes the kernel wrote.
+static void finish_write(struct WriteSlot *slot, size_t written) {
+  for (int i = 0; i < slot->iovcnt; i++) {
+    const char *ptr = slot->iov[i].iov_base;
+    size_t len = slot->iov[i].iov_len;
+
+    if (written >= len) {
+      written -= len;
+      continue;
+    }
+    ptr += written;
+    len -= written;
+    written = 0;
+
+    while (len > 0) {
+      ssize_t n = write(slot->fd, ptr, len);
+      if (n < 0) {
+        perror("Error writing string");
+        return;
+      }
+      ptr += n;
+      len -= (size_t)n;
+    }
+  }
+}
+
+// Handles the completions the kernel has posted so far.
+static void reap(void) {
+  unsigned head = *ring->cq_head;
+
+  while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+    if (cqe->user_data == AHEAD_TAG) {
+      ring->ahead_pending = 0;
+      ring->ahead_res = cqe->res;
+    } else {
+      struct WriteSlot *slot = &ring->writes[cqe->user_data];
+      if (cqe->res < 0) {
+        errno = -cqe->res;
+        perror("Error writing string");
+      } else if ((size_t)cqe->res < slot->total) {
+        finish_write(slot, (size_t)cqe->res);
+      }
+      for (size_t i = 0; i < slot->num_owned; i++) {
+        free(slot->owned[i]);
+      }
+      slot->fd = -1;
+    }
+
+    head++;
+  }
+
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Blocks until the kernel posts a completion.
+static void wait_completion(void) {
+  if (sys_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+      errno != EINTR) {
+    perror("Error waiting for io_uring");
+  }
+}
+
+// Starts reading the next block of a job file.
+static void read_ahead(int fd) {
+  struct io_uring_sqe sqe;
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = ring->ahead_fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe.fd = fd;
+  sqe.off = NO_OFFSET;
+  sqe.addr = (__u64)(uintptr_t)ring->ahead;
+  sqe.len = sizeof(ring->ahead);
+  sqe.buf_index = 0;
+  sqe.user_data = AHEAD_TAG;
+
+  ring->ahead_fd = fd;
+  ring->ahead_pending = 1;
+  ring->ahead_pos = 0;
+  ring->ahead_len = 0;
+  submit(&sqe);
+}
+
+// Waits for the read ahead in flight, if any.
+static void wait_ahead(void) {
+  for (;;) {
+    reap();
+    if (!ring->ahead_pending) {
+      break;
+    }
+    wait_completion();
+  }
+
+  if (ring->ahead_fd != -1 && ring->ahead_res > 0) {
+    ring->ahead_len = (size_t)ring->ahead_res;
+    ring->ahead_res = 0;
+  }
+}
+
+ssize_t uring_read(int fd, void *dest, size_t count) {
+  if (ring->ahead_fd != fd) {
+    wait_ahead();
+    read_ahead(fd);
+  }
+
+  wait_ahead();
+  if (ring->ahead_res < 0) {
+    errno = -(int)ring->ahead_res;
+    ring->ahead_fd = -1;
+    ring->ahead_res = 0;
+    return -1;
+  }
+
+  size_t left = ring->ahead_len - ring->ahead_pos;
+  if (left == 0) {
+    // end of the file, the descriptor may be reused for another one
+    ring->ahead_fd = -1;
+    return 0;
+  }
+
+  if (count > left) {
+    count = left;
+  }
+  memcpy(dest, ring->ahead + ring->ahead_pos, count);
+  ring->ahead_pos += count;
+
+  if (ring->ahead_pos == ring->ahead_len) {
+    read_ahead(fd);
+  }
+  return (ssize_t)count;
+}
+
+size_t uring_unread(int fd) {
+  if (ring == NULL || ring->ahead_fd != fd) {
+    return 0;
+  }
+
+  wait_ahead();
+  size_t unread = ring->ahead_len - ring->ahead_pos;
+  ring->ahead_fd = -1;
+  ring->ahead_pos = 0;
+  ring->ahead_len = 0;
+  return unread;
+}
+
+// Tells if there are queued writes to a file.
+// @param fd File descriptor, -1 for any file.
+static int writes_pending(int fd) {
+  for (size_t i = 0; i < URING_WRITE_SLOTS; i++) {
+    if (ring->writes[i].fd != -1 && (fd == -1 || ring->writes[i].fd == fd)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void uring_sync(int fd) {
+  if (ring == NULL) {
+    return;
+  }
+
+  for (;;) {
+    reap();
+    if (!writes_pending(fd)) {
+      return;
+    }
+    wait_completion();
+  }
+}
+
+int uring_writev(int fd, const struct iovec *iov, int iovcnt, char *owned[],
+                 size_t num_owned) {
+  if (!uring_active() || iovcnt > URING_MAX_IOV ||
+      num_owned > URING_MAX_IOV) {
+    return -1;
+  }
+
+  // one write per file at a time keeps them in order
+  uring_sync(fd);
+
+  struct WriteSlot *slot = NULL;
+  while (slot == NULL) {
+    for (size_t i = 0; i < URING_WRITE_SLOTS && slot == NULL; i++) {
+      if (ring->writes[i].fd == -1) {
+        slot = &ring->writes[i];
+      }
+    }
+    if (slot == NULL) {
+      wait_completion();
+      reap();
+    }
+  }
+
+  slot->fd = fd;
+  slot->iovcnt = iovcnt;
+  slot->total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    slot->iov[i] = iov[i];
+    slot->total += iov[i].iov_len;
+  }
+  slot->num_owned = num_owned;
+  for (size_t i = 0; i < num_owned; i++) {
+    slot->owned[i] = owned[i];
+  }
+
+  struct io_uring_sqe sqe;
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = IORING_OP_WRITEV;
+  sqe.fd = fd;
+  sqe.off = NO_OFFSET;
+  sqe.addr = (__u64)(uintptr_t)slot->iov;
+  sqe.len = (__u32)iovcnt;
+  sqe.user_data = (__u64)(slot - ring->writes);
+  submit(&sqe);
+  return 0;
+}
+
+void uring_exit(void) {
+  if (ring == NULL) {
+    return;
+  }
+
+  uring_sync(-1);
+  wait_ahead();
+  close(ring->fd);
+  unmap_ring(ring);
+  ring = NULL;
+}
+
+void uring_forget(void) {
+  if (ring != NULL) {
+    close(ring->fd);
+  }
+  ring = NULL;
+  ring_failed = 0;
+}
+
+#else // !URING_SUPPORTED
+
+int uring_active(void) { return 0; }
+
+ssize_t uring_read(int fd, void *dest, size_t count) {
+  return read(fd, dest, count);
+}
+
+size_t uring_unread(int fd) {
+  (void)fd;
+  return 0;
+}
+
+int uring_writev(int fd, const struct iovec *iov, int iovcnt, char *owned[],
+                 size_t num_owned) {
+  (void)fd;
+  (void)iov;
+  (void)iovcnt;
+  (void)owned;
+  (void)num_owned;
+  return -1;
+}
+
+void uring_sync(int fd) { (void)fd; }
+
+void uring_exit(void) {}
+
+void uring_forget(void) {}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef KVS_URING_H
+#define KVS_URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/// Optional io_uring backend for the job files, .out files and backups.
+/// Each thread gets its own ring the first time it does I/O through it.
+/// Reads of a job file keep the read of the following block in flight while
+/// the parser works, and writes are queued without waiting for them. When
+/// io_uring is off or the kernel refuses it, every function reports so and
+/// the callers use plain read and write.
+
+/// Makes the threads of this process use io_uring from now on.
+void uring_enable(void);
+
+/// Tells if the calling thread does its I/O through io_uring, creating its
+/// ring the first time.
+/// @return 1 if it does, 0 otherwise.
+int uring_active(void);
+
+/// Reads from the current position of a file, like read, and starts
+/// reading the block that follows it.
+/// @param fd File descriptor to read from.
+/// @param dest Where to store the bytes.
+/// @param count Maximum number of bytes to read.
+/// @return Number of bytes read, 0 at the end of the file, -1 on error.
+ssize_t uring_read(int fd, void *dest, size_t count);
+
+/// Drops what was read ahead of the caller from a file.
+/// @param fd File descriptor being read.
+/// @return Number of bytes read from fd that uring_read did not return.
+size_t uring_unread(int fd);
+
+/// Queues a write at the current position of a file. Writes to the same
+/// file are done in the order they are queued.
+/// @param fd File descriptor to write to.
+/// @param iov Buffers to write, copied by this function.
+/// @param iovcnt Number of buffers, at most URING_MAX_IOV.
+/// @param owned Memory to free once the write is done, may be NULL.
+/// @param num_owned Number of pointers in owned, at most URING_MAX_IOV.
+/// @return 0 if the write was queued, -1 otherwise.
+int uring_writev(int fd, const struct iovec *iov, int iovcnt, char *owned[],
+                 size_t num_owned);
+
+/// Waits for the queued writes to a file.
+/// @param fd File descriptor, -1 for every file.
+void uring_sync(int fd);
+
+/// Waits for every queued write and closes the ring of the calling thread.
+void uring_exit(void);
+
+/// Forgets the ring inherited from the parent in a child process, without
+/// using it. The child creates its own ring if it needs one.
+void uring_forget(void);
+
+#define URING_MAX_IOV 128
+
+#endif // KVS_URING_H
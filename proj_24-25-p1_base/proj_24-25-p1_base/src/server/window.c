@@ -0,0 +1,477 @@
+#include "window.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "io.h"
+#include "kvs.h"
+#include "operations.h"
+
+#define NO_COMMAND SIZE_MAX
+
+struct WindowCommand {
+  enum Command cmd;
+  size_t num_pairs;
+  struct Span *keys;
+  struct Span *values;
+  size_t spans_cap;
+  char *bytes; // copies of the keys and values the spans point to
+  size_t bytes_cap;
+  size_t dependents[JOB_WINDOW_SIZE]; // commands that wait for this one
+  size_t num_dependents;
+  size_t missing; // unfinished commands this one waits for
+  struct OutputBuffer out;
+};
+
+// Last accesses to a key by the commands of a window.
+struct KeyAccess {
+  struct Span key; // key.start is NULL for an empty slot
+  size_t writer;   // last WRITE or DELETE of the key
+  size_t readers;  // first node of the list of READs since that writer
+};
+
+// Node of a list of READs of a key.
+struct ReaderNode {
+  size_t command;
+  size_t next;
+};
+
+struct CommandWindow {
+  struct WindowCommand commands[JOB_WINDOW_SIZE];
+  size_t count;
+  int out_fd;
+  struct WindowPool *pool;
+
+  // guarded by the pool's mutex
+  size_t ready[JOB_WINDOW_SIZE]; // commands whose dependencies are done
+  size_t ready_head;
+  size_t ready_tail;
+  size_t remaining; // commands not executed yet
+  int queued; // whether the window is in the pool's list
+  struct CommandWindow *next_queued;
+  pthread_cond_t done_cond; // window_run waits for all commands
+};
+
+struct WindowPool {
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond; // workers wait for ready commands
+  struct CommandWindow *queued_head; // windows with ready commands
+  struct CommandWindow *queued_tail;
+  int stop;
+  pthread_t *workers;
+  size_t num_workers;
+};
+
+// Executes a command, keeping its output in the command's buffer.
+// @param command The command.
+static void execute_command(struct WindowCommand *command) {
+  switch (command->cmd) {
+  case CMD_WRITE:
+    if (kvs_write_spans(command->num_pairs, command->keys, command->values)) {
+      write_str(STDERR_FILENO, "Failed to write pair\n");
+    }
+    break;
+
+  case CMD_READ:
+    if (kvs_read_spans(command->num_pairs, command->keys, &command->out)) {
+      write_str(STDERR_FILENO, "Failed to read pair\n");
+    }
+    break;
+
+  case CMD_DELETE:
+    if (kvs_delete_spans(command->num_pairs, command->keys, &command->out)) {
+      write_str(STDERR_FILENO, "Failed to delete pair\n");
+    }
+    break;
+
+  case CMD_SHOW:
+    kvs_show(&command->out);
+    break;
+
+  case CMD_WAIT:
+  case CMD_BACKUP:
+  case CMD_HELP:
+  case CMD_EMPTY:
+  case CMD_INVALID:
+  case EOC:
+    break;
+  }
+}
+
+// Marks a command as ready and hands its window to the workers.
+// Called with the pool's mutex held.
+// @param window The window.
+// @param index The command.
+static void push_ready(struct CommandWindow *window, size_t index) {
+  struct WindowPool *pool = window->pool;
+
+  window->ready[window->ready_tail++] = index;
+  if (!window->queued) {
+    window->queued = 1;
+    window->next_queued = NULL;
+    if (pool->queued_tail != NULL) {
+      pool->queued_tail->next_queued = window;
+    } else {
+      pool->queued_head = window;
+    }
+    pool->queued_tail = window;
+  }
+  pthread_cond_signal(&pool->work_cond);
+}
+
+static void *window_worker(void *arg) {
+  struct WindowPool *pool = (struct WindowPool *)arg;
+
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    while (!pool->stop && pool->queued_head == NULL) {
+      pthread_cond_wait(&pool->work_cond, &pool->mutex);
+    }
+    if (pool->stop) {
+      break;
+    }
+
+    struct CommandWindow *window = pool->queued_head;
+    size_t index = window->ready[window->ready_head++];
+    if (window->ready_head == window->ready_tail) {
+      window->queued = 0;
+      pool->queued_head = window->next_queued;
+      if (pool->queued_head == NULL) {
+        pool->queued_tail = NULL;
+      }
+    }
+    struct WindowCommand *command = &window->commands[index];
+    pthread_mutex_unlock(&pool->mutex);
+
+    execute_command(command);
+
+    pthread_mutex_lock(&pool->mutex);
+    for (size_t i = 0; i < command->num_dependents; i++) {
+      struct WindowCommand *dependent =
+          &window->commands[command->dependents[i]];
+      if (--dependent->missing == 0) {
+        push_ready(window, command->dependents[i]);
+      }
+    }
+
+    if (--window->remaining == 0) {
+      pthread_cond_signal(&window->done_cond);
+    }
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+
+struct WindowPool *window_pool_create(size_t num_workers) {
+  struct WindowPool *pool = calloc(1, sizeof(struct WindowPool));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  pool->workers = malloc(num_workers * sizeof(pthread_t));
+  if (pool->workers == NULL) {
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+
+  for (size_t i = 0; i < num_workers; i++) {
+    if (pthread_create(&pool->workers[i], NULL, window_worker, pool) != 0) {
+      fprintf(stderr, "Failed to create window worker %zu\n", i);
+      break;
+    }
+    pool->num_workers++;
+  }
+
+  if (pool->num_workers == 0) {
+    window_pool_destroy(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+void window_pool_destroy(struct WindowPool *pool) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (size_t i = 0; i < pool->num_workers; i++) {
+    pthread_join(pool->workers[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->workers);
+  free(pool);
+}
+
+struct CommandWindow *window_create(struct WindowPool *pool, int out_fd) {
+  struct CommandWindow *window = calloc(1, sizeof(struct CommandWindow));
+  if (window == NULL) {
+    return NULL;
+  }
+
+  window->out_fd = out_fd;
+  window->pool = pool;
+  pthread_cond_init(&window->done_cond, NULL);
+  return window;
+}
+
+int window_add(struct CommandWindow *window, enum Command cmd,
+               size_t num_pairs, const struct Span keys[],
+               const struct Span values[]) {
+  if (window->count == JOB_WINDOW_SIZE) {
+    window_run(window);
+  }
+
+  struct WindowCommand *command = &window->commands[window->count];
+  size_t num_bytes = 0;
+  for (size_t i = 0; i < num_pairs; i++) {
+    num_bytes += keys[i].len + (values != NULL ? values[i].len : 0);
+  }
+
+  if (num_pairs > command->spans_cap) {
+    struct Span *new_keys =
+        realloc(command->keys, num_pairs * sizeof(struct Span));
+    if (new_keys == NULL) {
+      return 1;
+    }
+    command->keys = new_keys;
+
+    struct Span *new_values =
+        realloc(command->values, num_pairs * sizeof(struct Span));
+    if (new_values == NULL) {
+      return 1;
+    }
+    command->values = new_values;
+    command->spans_cap = num_pairs;
+  }
+
+  if (num_bytes > command->bytes_cap) {
+    char *new_bytes = realloc(command->bytes, num_bytes);
+    if (new_bytes == NULL) {
+      return 1;
+    }
+    command->bytes = new_bytes;
+    command->bytes_cap = num_bytes;
+  }
+
+  char *dest = command->bytes;
+  for (size_t i = 0; i < num_pairs; i++) {
+    memcpy(dest, keys[i].start, keys[i].len);
+    command->keys[i] = (struct Span){dest, keys[i].len};
+    dest += keys[i].len;
+
+    if (values != NULL) {
+      memcpy(dest, values[i].start, values[i].len);
+      command->values[i] = (struct Span){dest, values[i].len};
+      dest += values[i].len;
+    }
+  }
+
+  command->cmd = cmd;
+  command->num_pairs = num_pairs;
+  command->num_dependents = 0;
+  command->missing = 0;
+  window->count++;
+  return 0;
+}
+
+// Makes a command wait for an earlier one.
+// @param window The window.
+// @param from The earlier command.
+// @param to The command that has to wait.
+static void add_dependency(struct CommandWindow *window, size_t from,
+                           size_t to) {
+  struct WindowCommand *command = &window->commands[from];
+
+  // dependencies of a command are added together, so a repeated one (two
+  // keys shared by the same commands) is always the last in the list
+  if (from == to || (command->num_dependents > 0 &&
+                     command->dependents[command->num_dependents - 1] == to)) {
+    return;
+  }
+
+  command->dependents[command->num_dependents++] = to;
+  window->commands[to].missing++;
+}
+
+static int is_mutation(enum Command cmd) {
+  return cmd == CMD_WRITE || cmd == CMD_DELETE;
+}
+
+// FNV-1a hash of a key.
+static size_t hash_span(struct Span key) {
+  size_t hash = 14695981039346656037u;
+  for (size_t i = 0; i < key.len; i++) {
+    hash ^= (unsigned char)key.start[i];
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+// Finds the accesses to a key, adding an empty entry if it has none yet.
+// @param index Open addressing table of accesses.
+// @param capacity Size of the table, a power of two.
+// @param key The key.
+static struct KeyAccess *find_access(struct KeyAccess *index, size_t capacity,
+                                     struct Span key) {
+  size_t slot = hash_span(key) & (capacity - 1);
+
+  while (index[slot].key.start != NULL) {
+    if (index[slot].key.len == key.len &&
+        memcmp(index[slot].key.start, key.start, key.len) == 0) {
+      return &index[slot];
+    }
+    slot = (slot + 1) & (capacity - 1);
+  }
+
+  index[slot].key = key;
+  index[slot].writer = NO_COMMAND;
+  index[slot].readers = NO_COMMAND;
+  return &index[slot];
+}
+
+// Finds the table bucket of a key.
+// @param key The key.
+// @return Index of the bucket, -1 if the key has none.
+static int bucket_of(struct Span key) {
+  return key.len > 0 ? hash(key.start) : -1;
+}
+
+// Finds which commands of the window must run after which. Two commands
+// depend on each other if they share a key and one of them changes it, or
+// if one is a SHOW and the other a WRITE or DELETE. WRITEs and DELETEs of
+// keys in the same bucket also keep their order, since inserting and
+// removing nodes changes the order SHOW and BACKUP list the bucket in.
+static void build_dependencies(struct CommandWindow *window) {
+  size_t num_keys = 0;
+  for (size_t i = 0; i < window->count; i++) {
+    num_keys += window->commands[i].num_pairs;
+  }
+
+  size_t capacity = 16;
+  while (capacity < 2 * num_keys) {
+    capacity *= 2;
+  }
+
+  struct KeyAccess *index = calloc(capacity, sizeof(struct KeyAccess));
+  struct ReaderNode *readers =
+      malloc((num_keys + 1) * sizeof(struct ReaderNode));
+  size_t num_readers = 0;
+
+  if (index == NULL || readers == NULL) {
+    // run the commands one after the other
+    for (size_t i = 1; i < window->count; i++) {
+      add_dependency(window, i - 1, i);
+    }
+    free(index);
+    free(readers);
+    return;
+  }
+
+  size_t last_mutation[TABLE_SIZE];
+  for (size_t b = 0; b < TABLE_SIZE; b++) {
+    last_mutation[b] = NO_COMMAND;
+  }
+
+  for (size_t i = 0; i < window->count; i++) {
+    struct WindowCommand *command = &window->commands[i];
+
+    if (command->cmd == CMD_SHOW || is_mutation(command->cmd)) {
+      for (size_t j = 0; j < i; j++) {
+        enum Command earlier = window->commands[j].cmd;
+        if ((command->cmd == CMD_SHOW && is_mutation(earlier)) ||
+            (is_mutation(command->cmd) && earlier == CMD_SHOW)) {
+          add_dependency(window, j, i);
+        }
+      }
+    }
+
+    for (size_t k = 0; k < command->num_pairs; k++) {
+      struct KeyAccess *access = find_access(index, capacity, command->keys[k]);
+      int bucket = bucket_of(command->keys[k]);
+
+      if (is_mutation(command->cmd) && bucket >= 0) {
+        if (last_mutation[bucket] != NO_COMMAND) {
+          add_dependency(window, last_mutation[bucket], i);
+        }
+        last_mutation[bucket] = i;
+      }
+
+      if (access->writer != NO_COMMAND) {
+        add_dependency(window, access->writer, i);
+      }
+
+      if (command->cmd == CMD_READ) {
+        readers[num_readers] = (struct ReaderNode){i, access->readers};
+        access->readers = num_readers++;
+      } else {
+        for (size_t r = access->readers; r != NO_COMMAND; r = readers[r].next) {
+          add_dependency(window, readers[r].command, i);
+        }
+        access->readers = NO_COMMAND;
+        access->writer = i;
+      }
+    }
+  }
+
+  free(index);
+  free(readers);
+}
+
+void window_run(struct CommandWindow *window) {
+  if (window->count == 0) {
+    return;
+  }
+
+  build_dependencies(window);
+
+  struct WindowPool *pool = window->pool;
+
+  pthread_mutex_lock(&pool->mutex);
+  window->ready_head = 0;
+  window->ready_tail = 0;
+  window->remaining = window->count;
+  for (size_t i = 0; i < window->count; i++) {
+    if (window->commands[i].missing == 0) {
+      push_ready(window, i);
+    }
+  }
+
+  while (window->remaining > 0) {
+    pthread_cond_wait(&window->done_cond, &pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  struct OutputBuffer *outs[JOB_WINDOW_SIZE];
+  for (size_t i = 0; i < window->count; i++) {
+    outs[i] = &window->commands[i].out;
+  }
+  output_flush_all(outs, window->count, window->out_fd);
+  window->count = 0;
+}
+
+void window_destroy(struct CommandWindow *window) {
+  window_run(window);
+
+  for (size_t i = 0; i < JOB_WINDOW_SIZE; i++) {
+    free(window->commands[i].keys);
+    free(window->commands[i].values);
+    free(window->commands[i].bytes);
+    output_free(&window->commands[i].out);
+  }
+
+  pthread_cond_destroy(&window->done_cond);
+  free(window);
+}
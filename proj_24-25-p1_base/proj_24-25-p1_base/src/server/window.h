@@ -0,0 +1,55 @@
+#ifndef KVS_WINDOW_H
+#define KVS_WINDOW_H
+
+#include <stddef.h>
+
+#include "parser.h"
+#include "span.h"
+
+/// Worker threads shared by the command windows of every job.
+struct WindowPool;
+
+/// Group of consecutive commands of one job file that are executed together.
+/// Commands that do not touch the same keys are handed to the pool at the
+/// same time, and their output is written in the job's order. READs and
+/// SHOWs overlap with each other, but WRITEs and DELETEs still hold the
+/// table lock for writing, so they run one at a time.
+struct CommandWindow;
+
+/// Starts the worker threads shared by all windows.
+/// @param num_workers Number of worker threads.
+/// @return Newly created pool, NULL on failure.
+struct WindowPool *window_pool_create(size_t num_workers);
+
+/// Stops and joins the worker threads. Every window must be destroyed first.
+/// @param pool The pool.
+void window_pool_destroy(struct WindowPool *pool);
+
+/// Creates a command window whose commands run on a pool.
+/// @param pool The pool.
+/// @param out_fd File descriptor of the job's output file.
+/// @return Newly created window, NULL on failure.
+struct CommandWindow *window_create(struct WindowPool *pool, int out_fd);
+
+/// Adds a WRITE, READ, DELETE or SHOW command to the window, running the
+/// window first if it is full. Keys and values are copied.
+/// @param window The window.
+/// @param cmd The command.
+/// @param num_pairs Number of keys (and values) of the command.
+/// @param keys Array of keys.
+/// @param values Array of values, NULL unless cmd is CMD_WRITE.
+/// @return 0 if the command was added, 1 otherwise.
+int window_add(struct CommandWindow *window, enum Command cmd,
+               size_t num_pairs, const struct Span keys[],
+               const struct Span values[]);
+
+/// Executes every command in the window and writes their output. Used
+/// before commands that must not overlap with others, such as WAIT or BACKUP.
+/// @param window The window.
+void window_run(struct CommandWindow *window);
+
+/// Runs the remaining commands and frees the window.
+/// @param window The window.
+void window_destroy(struct CommandWindow *window);
+
+#endif // KVS_WINDOW_H
@@ -0,0 +1,281 @@
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+
+// Generates directories of synthetic .job files to measure the server.
+// Keys are drawn from a Zipfian distribution, so a few keys get most of the
+// accesses when the skew grows, and a skew of 0 accesses them uniformly.
+
+struct Workload {
+  size_t jobs;         // .job files to generate
+  size_t commands;     // commands in each job
+  size_t keys;         // distinct keys
+  double skew;         // Zipfian exponent, 0 for uniform
+  unsigned int mix[3]; // weights of READ, WRITE and DELETE
+  size_t batch;        // maximum keys per command
+  size_t wait_every;   // a WAIT every this many commands on average, 0 never
+  unsigned int wait_ms;
+  size_t backup_every; // a BACKUP every this many commands on average
+  uint64_t seed;
+};
+
+// Returns the next number of a splitmix64 sequence.
+static uint64_t next_random(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Returns a random number in [0, 1).
+static double random_unit(uint64_t *state) {
+  return (double)(next_random(state) >> 11) / (double)(1ULL << 53);
+}
+
+// Builds the cumulative distribution of the key ranks.
+// @param keys Number of keys.
+// @param skew Zipfian exponent.
+// @return The distribution, NULL on failure.
+static double *zipf_table(size_t keys, double skew) {
+  double *cdf = malloc(keys * sizeof(double));
+  if (cdf == NULL) {
+    return NULL;
+  }
+
+  double sum = 0;
+  for (size_t i = 0; i < keys; i++) {
+    sum += 1.0 / pow((double)(i + 1), skew);
+    cdf[i] = sum;
+  }
+  for (size_t i = 0; i < keys; i++) {
+    cdf[i] /= sum;
+  }
+  return cdf;
+}
+
+// Draws a key rank from the distribution.
+static size_t zipf_key(const double *cdf, size_t keys, uint64_t *state) {
+  double u = random_unit(state);
+  size_t lo = 0;
+  size_t hi = keys - 1;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (cdf[mid] < u) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Writes the name of a key. The table buckets keys by their first letter,
+// so the first letter spreads the keys over every bucket.
+static void write_key(FILE *file, size_t rank) {
+  fprintf(file, "%c%zu", 'a' + (int)(rank % 26), rank / 26);
+}
+
+// Tells if an event that happens every given number of commands on average
+// happens now.
+static int happens(size_t every, uint64_t *state) {
+  return every > 0 && next_random(state) % every == 0;
+}
+
+// Writes one job file.
+// @return Number of key operations written, 0 on failure.
+static size_t write_job(const struct Workload *w, const double *cdf,
+                        const char *path, uint64_t *state) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+
+  unsigned int total = w->mix[0] + w->mix[1] + w->mix[2];
+  size_t ops = 0;
+
+  for (size_t c = 0; c < w->commands; c++) {
+    unsigned int pick = (unsigned int)(next_random(state) % total);
+    size_t count = 1 + (size_t)(next_random(state) % w->batch);
+
+    if (pick < w->mix[0]) {
+      fputs("READ [", file);
+      for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+          fputc(',', file);
+        }
+        write_key(file, zipf_key(cdf, w->keys, state));
+      }
+      fputs("]\n", file);
+    } else if (pick < w->mix[0] + w->mix[1]) {
+      fputs("WRITE [", file);
+      for (size_t i = 0; i < count; i++) {
+        fputc('(', file);
+        write_key(file, zipf_key(cdf, w->keys, state));
+        fprintf(file, ",v%llu)",
+                (unsigned long long)(next_random(state) % 1000000));
+      }
+      fputs("]\n", file);
+    } else {
+      fputs("DELETE [", file);
+      for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+          fputc(',', file);
+        }
+        write_key(file, zipf_key(cdf, w->keys, state));
+      }
+      fputs("]\n", file);
+    }
+    ops += count;
+
+    if (happens(w->wait_every, state)) {
+      fprintf(file, "WAIT %u\n", w->wait_ms);
+    }
+    if (happens(w->backup_every, state)) {
+      fputs("BACKUP\n", file);
+    }
+  }
+
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  return ops;
+}
+
+// Parses a number of an option.
+// @return 0 if the whole string is a number, 1 otherwise.
+static int parse_size(const char *str, size_t *value) {
+  char *end;
+  errno = 0;
+  unsigned long long n = strtoull(str, &end, 10);
+  if (errno != 0 || end == str || *end != '\0' || str[0] == '-') {
+    return 1;
+  }
+  *value = (size_t)n;
+  return 0;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-j jobs] [-c commands] [-k keys] [-z skew]\n"
+          "       [-m read,write,delete] [-b batch] [-w wait_every]\n"
+          "       [-t wait_ms] [-B backup_every] [-s seed] <jobs_dir>\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  struct Workload w = {
+      .jobs = 8,
+      .commands = 10000,
+      .keys = 10000,
+      .skew = 0.99,
+      .mix = {50, 40, 10},
+      .batch = 8,
+      .wait_every = 0,
+      .wait_ms = 1,
+      .backup_every = 0,
+      .seed = 1,
+  };
+  size_t value;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:c:k:z:m:b:w:t:B:s:")) != -1) {
+    int bad = 0;
+    char *end;
+    switch (opt) {
+    case 'j':
+      bad = parse_size(optarg, &w.jobs);
+      break;
+    case 'c':
+      bad = parse_size(optarg, &w.commands);
+      break;
+    case 'k':
+      bad = parse_size(optarg, &w.keys) || w.keys == 0;
+      break;
+    case 'z':
+      w.skew = strtod(optarg, &end);
+      bad = *end != '\0' || end == optarg || w.skew < 0;
+      break;
+    case 'm':
+      bad = sscanf(optarg, "%u,%u,%u", &w.mix[0], &w.mix[1], &w.mix[2]) != 3 ||
+            w.mix[0] + w.mix[1] + w.mix[2] == 0;
+      break;
+    case 'b':
+      bad = parse_size(optarg, &w.batch) || w.batch == 0 ||
+            w.batch > MAX_WRITE_SIZE;
+      break;
+    case 'w':
+      bad = parse_size(optarg, &w.wait_every);
+      break;
+    case 't':
+      bad = parse_size(optarg, &value) || value > UINT32_MAX;
+      w.wait_ms = (unsigned int)value;
+      break;
+    case 'B':
+      bad = parse_size(optarg, &w.backup_every);
+      break;
+    case 's':
+      bad = parse_size(optarg, &value);
+      w.seed = value;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+    if (bad) {
+      fprintf(stderr, "Invalid value for -%c: %s\n", opt, optarg);
+      return 1;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+  const char *dir = argv[optind];
+
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s: %s\n", dir, strerror(errno));
+    return 1;
+  }
+
+  double *cdf = zipf_table(w.keys, w.skew);
+  if (cdf == NULL) {
+    fprintf(stderr, "Failed to allocate memory for %zu keys\n", w.keys);
+    return 1;
+  }
+
+  uint64_t state = w.seed;
+  size_t ops = 0;
+  for (size_t j = 0; j < w.jobs; j++) {
+    char path[MAX_JOB_FILE_NAME_SIZE];
+    int len = snprintf(path, sizeof(path), "%s/w%zu.job", dir, j);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+      fprintf(stderr, "Path too long: %s\n", dir);
+      free(cdf);
+      return 1;
+    }
+
+    size_t job_ops = write_job(&w, cdf, path, &state);
+    if (job_ops == 0 && w.commands > 0) {
+      free(cdf);
+      return 1;
+    }
+    ops += job_ops;
+  }
+
+  free(cdf);
+
+  // the total is what the benchmark divides by the wall time
+  printf("%zu\n", ops);
+  return 0;
+}